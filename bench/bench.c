@@ -0,0 +1,299 @@
+/* skm - scheme interpreter
+ * author: Eugene Ma (edma2) */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+/* Runs skm on each workload in a manifest and prints a line of
+ * tab separated results for it:
+ *
+ * 	name wall_ms ns_per_call calls allocs alloc_bytes maxrss_kb change
+ *
+ * wall_ms is the best of the runs. calls is the number of frames
+ * skm made, which counts calls to lambdas but not to primitives.
+ * allocs and alloc_bytes come from count.so, preloaded into skm.
+ * change is how wall_ms compares to the same workload in the
+ * baseline given with -c, a file this printed before */
+
+#define MAX_ARGS 	16
+#define MAX_LINE 	1024
+#define MAX_BENCH 	256
+
+typedef struct {
+	char name[64];
+	double wall_ms;
+	long calls;
+	/* -1 if they weren't counted */
+	long allocs;
+	long bytes;
+	long maxrss;
+} Result;
+
+static int bench(char *line, Result *res);
+static int run(char **argv, Result *res);
+static void parse_stats(int fd, Result *res, FILE *rest);
+static int load_baseline(char *path);
+static Result *find_baseline(char *name);
+static void print_header(FILE *out);
+static void print_result(FILE *out, Result *res);
+static double now(void);
+
+static char *skm = "../skm";
+static char preload[PATH_MAX];
+static int runs = 5;
+static Result baseline[MAX_BENCH];
+static int nbaseline = 0;
+
+static void usage(void) {
+	fprintf(stderr, "usage: bench [-n runs] [-s skm] [-c baseline] "
+			"[-o output] [manifest]\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[]) {
+	char line[MAX_LINE];
+	char *manifest = "manifest", *output = NULL;
+	FILE *in, *out = NULL;
+	Result res;
+	int c, failed = 0;
+
+	while ((c = getopt(argc, argv, "n:s:c:o:")) != -1) {
+		switch (c) {
+		case 'n':
+			runs = atoi(optarg);
+			if (runs < 1)
+				usage();
+			break;
+		case 's':
+			skm = optarg;
+			break;
+		case 'c':
+			/* a baseline that isn't there yet is no baseline */
+			if (access(optarg, R_OK) == 0 && load_baseline(optarg) < 0)
+				return 1;
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind < argc)
+		manifest = argv[optind];
+	/* skm runs without it if it wasn't built */
+	if (realpath("count.so", preload) == NULL)
+		preload[0] = '\0';
+	in = fopen(manifest, "r");
+	if (in == NULL) {
+		perror(manifest);
+		return 1;
+	}
+	if (output != NULL) {
+		out = fopen(output, "w");
+		if (out == NULL) {
+			perror(output);
+			return 1;
+		}
+		print_header(out);
+	}
+	print_header(stdout);
+	while (fgets(line, sizeof(line), in) != NULL) {
+		line[strcspn(line, "\n")] = '\0';
+		if (line[0] == '#' || line[strspn(line, " \t")] == '\0')
+			continue;
+		if (bench(line, &res) < 0) {
+			failed = 1;
+			continue;
+		}
+		print_result(stdout, &res);
+		fflush(stdout);
+		if (out != NULL)
+			print_result(out, &res);
+	}
+	fclose(in);
+	if (out != NULL)
+		fclose(out);
+	return failed;
+}
+
+/************************************************/
+/*****************   Running   ******************/
+/************************************************/
+
+/* line is a name followed by the arguments to give skm */
+static int bench(char *line, Result *res) {
+	char *argv[MAX_ARGS + 2];
+	char *name;
+	Result r;
+	int argc = 0, i;
+
+	name = strtok(line, " \t");
+	argv[argc++] = skm;
+	while (argc <= MAX_ARGS && (argv[argc] = strtok(NULL, " \t")) != NULL)
+		argc++;
+	argv[argc] = NULL;
+	for (i = 0; i < runs; i++) {
+		if (run(argv, &r) < 0) {
+			fprintf(stderr, "bench: %s failed\n", name);
+			return -1;
+		}
+		if (i == 0 || r.wall_ms < res->wall_ms)
+			*res = r;
+	}
+	snprintf(res->name, sizeof(res->name), "%s", name);
+	return 0;
+}
+
+/* Run skm once with its output thrown away, what it reports
+ * about itself comes back on its standard error. The rest of
+ * that is only passed on if it fails */
+static int run(char **argv, Result *res) {
+	struct rusage ru;
+	double start;
+	pid_t pid;
+	int fds[2], null, status;
+	FILE *rest;
+	char *errors = NULL;
+	size_t nerrors = 0;
+
+	if (pipe(fds) < 0) {
+		perror("pipe");
+		return -1;
+	}
+	start = now();
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+	if (pid == 0) {
+		null = open("/dev/null", O_WRONLY);
+		dup2(null, STDOUT_FILENO);
+		dup2(fds[1], STDERR_FILENO);
+		close(fds[0]);
+		setenv("SKM_STATS", "1", 1);
+		if (preload[0] != '\0')
+			setenv("LD_PRELOAD", preload, 1);
+		execv(argv[0], argv);
+		perror(argv[0]);
+		_exit(127);
+	}
+	close(fds[1]);
+	rest = open_memstream(&errors, &nerrors);
+	parse_stats(fds[0], res, rest);
+	if (rest != NULL)
+		fclose(rest);
+	if (wait4(pid, &status, 0, &ru) < 0) {
+		perror("wait4");
+		free(errors);
+		return -1;
+	}
+	res->wall_ms = (now() - start) * 1e3;
+	res->maxrss = ru.ru_maxrss;
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		if (errors != NULL)
+			fputs(errors, stderr);
+		free(errors);
+		return -1;
+	}
+	free(errors);
+	return 0;
+}
+
+/* pick out the lines skm and count.so print at exit, the rest
+ * go to rest if it isn't NULL. Reads fd to the end and closes it */
+static void parse_stats(int fd, Result *res, FILE *rest) {
+	char line[MAX_LINE];
+	FILE *in = fdopen(fd, "r");
+
+	res->calls = 0;
+	res->allocs = -1;
+	res->bytes = -1;
+	if (in == NULL) {
+		close(fd);
+		return;
+	}
+	while (fgets(line, sizeof(line), in) != NULL) {
+		if (sscanf(line, "stats: %ld frames", &res->calls) == 1)
+			continue;
+		if (sscanf(line, "alloc: %ld calls, %ld bytes", &res->allocs, &res->bytes) == 2)
+			continue;
+		if (rest != NULL)
+			fputs(line, rest);
+	}
+	fclose(in);
+}
+
+/************************************************/
+/*****************   Results   ******************/
+/************************************************/
+
+static int load_baseline(char *path) {
+	char line[MAX_LINE];
+	FILE *in = fopen(path, "r");
+	Result *r;
+
+	if (in == NULL) {
+		perror(path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), in) != NULL && nbaseline < MAX_BENCH) {
+		r = &baseline[nbaseline];
+		if (sscanf(line, "%63s %lf", r->name, &r->wall_ms) == 2)
+			nbaseline++;
+	}
+	fclose(in);
+	return 0;
+}
+
+static Result *find_baseline(char *name) {
+	int i;
+
+	for (i = 0; i < nbaseline; i++) {
+		if (strcmp(baseline[i].name, name) == 0)
+			return &baseline[i];
+	}
+	return NULL;
+}
+
+static void print_header(FILE *out) {
+	fprintf(out, "name\twall_ms\tns_per_call\tcalls\tallocs\talloc_bytes\tmaxrss_kb\tchange\n");
+}
+
+/* a dash for anything that wasn't measured */
+static void print_result(FILE *out, Result *res) {
+	Result *base = find_baseline(res->name);
+
+	fprintf(out, "%s\t%.1f\t", res->name, res->wall_ms);
+	if (res->calls > 0)
+		fprintf(out, "%.1f\t", res->wall_ms * 1e6 / res->calls);
+	else
+		fprintf(out, "-\t");
+	fprintf(out, "%ld\t", res->calls);
+	if (res->allocs >= 0)
+		fprintf(out, "%ld\t%ld\t", res->allocs, res->bytes);
+	else
+		fprintf(out, "-\t-\t");
+	fprintf(out, "%ld\t", res->maxrss);
+	if (base != NULL && base->wall_ms > 0)
+		fprintf(out, "%+.1f%%\n", (res->wall_ms / base->wall_ms - 1) * 100);
+	else
+		fprintf(out, "-\n");
+}
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,27 @@
+(define cons
+  (lambda (a b)
+    (lambda (field)
+      (if (= field 'car) a b))))
+(define car (lambda (pair) (pair 'car)))
+(define cdr (lambda (pair) (pair 'cdr)))
+
+(define build
+  (lambda (i list)
+    (if (= i 0)
+      list
+      (build (- i 1) (cons i list)))))
+
+(define sum
+  (lambda (list acc)
+    (if (= list #f)
+      acc
+      (sum (cdr list) (+ acc (car list))))))
+
+(define repeat
+  (lambda (n acc)
+    (if (= n 0)
+      acc
+      (repeat (- n 1) (+ acc (sum (build 1000 #f) 0))))))
+
+(display (repeat 100 0))
+(newline)
@@ -0,0 +1,38 @@
+/* skm - scheme interpreter
+ * author: Eugene Ma (edma2) */
+#include <stdio.h>
+#include <stddef.h>
+
+/* Preloaded into skm by the bench harness to count the calls
+ * to the allocator. glibc lets malloc be replaced this way,
+ * these are what its own malloc and friends call */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+
+static long count = 0;
+static long bytes = 0;
+
+void *malloc(size_t size) {
+	count++;
+	bytes += size;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+	count++;
+	bytes += n * size;
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size) {
+	count++;
+	bytes += size;
+	return __libc_realloc(p, size);
+}
+
+/* runs after skm has printed its own stats line */
+__attribute__((destructor))
+static void count_report(void) {
+	fprintf(stderr, "alloc: %ld calls, %ld bytes\n", count, bytes);
+}
@@ -0,0 +1,12 @@
+(define loop
+  (lambda (i)
+    (if (= i 0)
+      0
+      (begin
+        (display i)
+        (display " bottles of beer, ")
+        (display (/ i 4))
+        (newline)
+        (loop (- i 1))))))
+
+(loop 200000)
@@ -0,0 +1,39 @@
+(define prelude
+  (lambda (port i)
+    (if (= i 0)
+      0
+      (begin
+        (display "(define f" port)
+        (display i port)
+        (display " (lambda (x y) (if (< x y) (+ x " port)
+        (display i port)
+        (display ") (- y x))))" port)
+        (newline port)
+        (display "(define v" port)
+        (display i port)
+        (display " (f" port)
+        (display i port)
+        (display " 1 2))" port)
+        (newline port)
+        (prelude port (- i 1))))))
+
+(define big
+  (lambda (port i)
+    (if (= i 0)
+      0
+      (begin
+        (display "(define (entry" port)
+        (display i port)
+        (display " a b) (cond ((< a " port)
+        (display i port)
+        (display ") (list-ref 'string 2.5 #t)) (else (lambda (x) (+ x b 'quoted)))))" port)
+        (newline port)
+        (big port (- i 1))))))
+
+(define port (open-output-file "prelude.scm"))
+(prelude port 20000)
+(close-output-port port)
+
+(define port (open-output-file "big.scm"))
+(big port 100000)
+(close-output-port port)
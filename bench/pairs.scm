@@ -0,0 +1,20 @@
+(define build
+  (lambda (i list)
+    (if (= i 0)
+      list
+      (build (- i 1) (cons i list)))))
+
+(define sum
+  (lambda (list acc)
+    (if (null? list)
+      acc
+      (sum (cdr list) (+ acc (car list))))))
+
+(define repeat
+  (lambda (n acc)
+    (if (= n 0)
+      acc
+      (repeat (- n 1) (+ acc (sum (build 1000 '()) 0))))))
+
+(display (repeat 100 0))
+(newline)
@@ -0,0 +1,8 @@
+(define loop
+  (lambda (i acc)
+    (if (= i 0)
+      acc
+      (loop (- i 1) (+ acc i)))))
+
+(display (loop 1000000 0))
+(newline)
@@ -0,0 +1,8 @@
+/* alloc.c - counting allocations
+ * author: Eugene Ma (edma2) */
+#include "ds.h"
+
+/* everything ds_malloc and friends have handed out, a
+ * realloc counts as one more allocation of its new size */
+long ds_allocs = 0;
+long ds_alloc_bytes = 0;
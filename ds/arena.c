@@ -0,0 +1,77 @@
+/* arena.c - bump allocation, everything is released at once
+ * author: Eugene Ma (edma2) */
+#include "ds.h"
+
+#define ARENA_MIN 	256
+/* every allocation is aligned to this */
+#define ARENA_ALIGN 	sizeof(void *)
+
+static Chunk *chunk_new(size_t size);
+
+/* create an arena whose first chunk holds size bytes */
+Arena *arena_new(size_t size) {
+        Arena *a;
+
+        a = ds_malloc(sizeof(Arena));
+        if (a == NULL)
+                return NULL;
+        if (size < ARENA_MIN)
+                size = ARENA_MIN;
+        a->chunk = chunk_new(size);
+        if (a->chunk == NULL) {
+                free(a);
+                return NULL;
+        }
+        a->size = size;
+        return a;
+}
+
+/* return n bytes that live as long as the arena */
+void *arena_alloc(Arena *a, size_t n) {
+        Chunk *c;
+        void *p;
+
+        if (a == NULL)
+                return NULL;
+        n = (n + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+        c = a->chunk;
+        if (c->used + n > c->size) {
+                /* chunks double so a big arena needs few of them */
+                while (a->size < n)
+                        a->size *= 2;
+                a->size *= 2;
+                c = chunk_new(a->size);
+                if (c == NULL)
+                        return NULL;
+                c->next = a->chunk;
+                a->chunk = c;
+        }
+        p = c->data + c->used;
+        c->used += n;
+        return p;
+}
+
+/* release the arena along with everything allocated from it */
+void arena_free(Arena *a) {
+        Chunk *c, *next;
+
+        if (a == NULL)
+                return;
+        for (c = a->chunk; c; c = next) {
+                next = c->next;
+                free(c);
+        }
+        free(a);
+}
+
+static Chunk *chunk_new(size_t size) {
+        Chunk *c;
+
+        c = ds_malloc(sizeof(Chunk) + size);
+        if (c == NULL)
+                return NULL;
+        c->next = NULL;
+        c->size = size;
+        c->used = 0;
+        return c;
+}
@@ -12,15 +12,55 @@ struct Node {
 typedef struct List List;
 struct List {
 	Node *head;			
+	/* so appending doesn't walk the list */
+	Node *tail;
 	int length;		
 };
 typedef struct Tree Tree;
 struct Tree {
 	struct Tree *parent;
 	struct Tree *next;
+	/* so a tree can be detached in constant time */
+	struct Tree *prev;
 	struct Tree *child;
 	void *data;
 };
+typedef struct Hash Hash;
+struct Hash {
+	void **keys;
+	void **data;
+	int capacity;
+	int count;
+	int used;
+};
+typedef struct Chunk Chunk;
+struct Chunk {
+	struct Chunk *next;
+	size_t size;
+	size_t used;
+	char data[];
+};
+/* bytes of items a vector holds before it needs the heap */
+#define VECTOR_SMALL 	64
+typedef struct Vector Vector;
+struct Vector {
+	char *items;
+	size_t elemsize;
+	int length;
+	int capacity;
+	union {
+		char bytes[VECTOR_SMALL];
+		/* keep the items aligned for anything */
+		long long l;
+		double d;
+		void *p;
+	} small;
+};
+typedef struct Arena Arena;
+struct Arena {
+	Chunk *chunk;
+	size_t size;
+};
 
 List *list_new(void); 	
 List *list_copy(List *ls);		
@@ -39,6 +79,7 @@ int list_size(List *ls);
 
 Tree *tree_new(void *data);
 Tree *tree_insert_child(Tree *t, void *data);
+Tree *tree_push_child(Tree *t, void *data);
 Tree *tree_insert_sib(Tree *t, void *data);
 Tree *tree_detach(Tree *t);
 Tree *tree_next(Tree *t);
@@ -52,3 +93,59 @@ void tree_print(Tree *t);
 int tree_is_root(Tree *t);
 int tree_is_leaf(Tree *t);
 int tree_count_children(Tree *t);
+
+Hash *hash_new(int size);
+void *hash_get(Hash *h, void *key);
+int hash_put(Hash *h, void *key, void *data, void **old);
+void *hash_remove(Hash *h, void *key);
+void hash_traverse(Hash *h, void (*func)(void *data));
+Vector *hash_vector(Hash *h);
+void hash_free(Hash *h);
+int hash_size(Hash *h);
+
+Vector *vector_new(size_t elemsize);
+void vector_init(Vector *v, size_t elemsize);
+void *vector_push(Vector *v, void *elem);
+void *vector_at(Vector *v, int i);
+void *vector_last(Vector *v);
+void *vector_data(Vector *v);
+void vector_pop(Vector *v);
+void vector_clear(Vector *v);
+void vector_release(Vector *v);
+void vector_free(Vector *v);
+int vector_size(Vector *v);
+
+Arena *arena_new(size_t size);
+void *arena_alloc(Arena *a, size_t n);
+void arena_free(Arena *a);
+
+/* allocations made through these are counted */
+extern long ds_allocs;
+extern long ds_alloc_bytes;
+
+static inline void *ds_malloc(size_t size) {
+	ds_allocs++;
+	ds_alloc_bytes += size;
+	return malloc(size);
+}
+
+static inline void *ds_calloc(size_t n, size_t size) {
+	ds_allocs++;
+	ds_alloc_bytes += n * size;
+	return calloc(n, size);
+}
+
+static inline void *ds_realloc(void *p, size_t size) {
+	ds_allocs++;
+	ds_alloc_bytes += size;
+	return realloc(p, size);
+}
+
+static inline char *ds_strdup(char *s) {
+	size_t n = strlen(s) + 1;
+	char *t = ds_malloc(n);
+
+	if (t != NULL)
+		memcpy(t, s, n);
+	return t;
+}
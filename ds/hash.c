@@ -0,0 +1,202 @@
+/* hash.c - open addressing hash tables keyed by address
+ * author: Eugene Ma (edma2) */
+#include "ds.h"
+
+#define HASH_MIN 	16
+/* marks a slot whose entry was removed */
+#define TOMBSTONE 	((void *)&hash_tombstone)
+
+static char hash_tombstone;
+static unsigned long hash_ptr(void *key);
+static int hash_grow(Hash *h);
+static long hash_find(Hash *h, void *key);
+
+/* create an empty table with room for at least size entries */
+Hash *hash_new(int size) {
+        Hash *h;
+        int cap = HASH_MIN;
+
+        h = ds_malloc(sizeof(Hash));
+        if (h == NULL)
+                return NULL;
+        /* keep the load factor under one half */
+        while (cap < size * 2)
+                cap *= 2;
+        h->keys = ds_calloc(cap, sizeof(void *));
+        h->data = ds_calloc(cap, sizeof(void *));
+        if (h->keys == NULL || h->data == NULL) {
+                free(h->keys);
+                free(h->data);
+                free(h);
+                return NULL;
+        }
+        h->capacity = cap;
+        h->count = 0;
+        h->used = 0;
+        return h;
+}
+
+/* return the data stored under key, NULL if there is none */
+void *hash_get(Hash *h, void *key) {
+        long i;
+
+        if (h == NULL || key == NULL)
+                return NULL;
+        i = hash_find(h, key);
+        return (i < 0) ? NULL : h->data[i];
+}
+
+/* store data under key, old is set to whatever was replaced.
+ * return zero on success */
+int hash_put(Hash *h, void *key, void *data, void **old) {
+        unsigned long mask, i;
+        long grave = -1;
+
+        if (old != NULL)
+                *old = NULL;
+        if (h == NULL || key == NULL)
+                return -1;
+        /* tombstones count towards the load factor too */
+        if ((h->used + 1) * 2 > h->capacity && hash_grow(h) < 0)
+                return -1;
+        mask = h->capacity - 1;
+        for (i = hash_ptr(key) & mask; h->keys[i]; i = (i + 1) & mask) {
+                if (h->keys[i] == key) {
+                        if (old != NULL)
+                                *old = h->data[i];
+                        h->data[i] = data;
+                        return 0;
+                }
+                /* remember the first free grave to reuse */
+                if (h->keys[i] == TOMBSTONE && grave < 0)
+                        grave = i;
+        }
+        if (grave >= 0) {
+                i = grave;
+        } else {
+                h->used++;
+        }
+        h->keys[i] = key;
+        h->data[i] = data;
+        h->count++;
+        return 0;
+}
+
+/* remove key from the table and return its data */
+void *hash_remove(Hash *h, void *key) {
+        void *data;
+        long i;
+
+        if (h == NULL || key == NULL)
+                return NULL;
+        i = hash_find(h, key);
+        if (i < 0)
+                return NULL;
+        data = h->data[i];
+        h->keys[i] = TOMBSTONE;
+        h->data[i] = NULL;
+        h->count--;
+        return data;
+}
+
+/* visit DATA of each entry in the table */
+void hash_traverse(Hash *h, void (*func)(void *data)) {
+        int i;
+
+        if (h == NULL)
+                return;
+        for (i = 0; i < h->capacity; i++) {
+                if (h->keys[i] && h->keys[i] != TOMBSTONE)
+                        (*func)(h->data[i]);
+        }
+}
+
+/* return a new vector holding the DATA of each entry */
+Vector *hash_vector(Hash *h) {
+        Vector *v;
+        int i;
+
+        if (h == NULL)
+                return NULL;
+        v = vector_new(sizeof(void *));
+        if (v == NULL)
+                return NULL;
+        for (i = 0; i < h->capacity; i++) {
+                if (h->keys[i] && h->keys[i] != TOMBSTONE) {
+                        if (!vector_push(v, &h->data[i])) {
+                                vector_free(v);
+                                return NULL;
+                        }
+                }
+        }
+        return v;
+}
+
+void hash_free(Hash *h) {
+        if (h == NULL)
+                return;
+        free(h->keys);
+        free(h->data);
+        free(h);
+}
+
+/* return number of entries in table */
+int hash_size(Hash *h) {
+        if (h == NULL)
+                return -1;
+        return h->count;
+}
+
+/* return index of key or -1 if it isn't there */
+static long hash_find(Hash *h, void *key) {
+        unsigned long mask = h->capacity - 1, i;
+
+        for (i = hash_ptr(key) & mask; h->keys[i]; i = (i + 1) & mask) {
+                if (h->keys[i] == key)
+                        return i;
+        }
+        return -1;
+}
+
+/* rehash into a table twice the size, dropping tombstones */
+static int hash_grow(Hash *h) {
+        void **keys = h->keys, **data = h->data;
+        int cap = h->capacity, i;
+        unsigned long mask, j;
+
+        /* only grow if it's mostly live entries */
+        if (h->count * 4 >= cap)
+                cap *= 2;
+        h->keys = ds_calloc(cap, sizeof(void *));
+        h->data = ds_calloc(cap, sizeof(void *));
+        if (h->keys == NULL || h->data == NULL) {
+                free(h->keys);
+                free(h->data);
+                h->keys = keys;
+                h->data = data;
+                return -1;
+        }
+        mask = cap - 1;
+        for (i = 0; i < h->capacity; i++) {
+                if (keys[i] == NULL || keys[i] == TOMBSTONE)
+                        continue;
+                for (j = hash_ptr(keys[i]) & mask; h->keys[j]; j = (j + 1) & mask)
+                        ;
+                h->keys[j] = keys[i];
+                h->data[j] = data[i];
+        }
+        h->capacity = cap;
+        h->used = h->count;
+        free(keys);
+        free(data);
+        return 0;
+}
+
+/* scramble an address, the low bits are always zero */
+static unsigned long hash_ptr(void *key) {
+        unsigned long k = (unsigned long)key;
+
+        k ^= k >> 4;
+        k *= 0x9e3779b97f4a7c15UL;
+        return k >> 16;
+}
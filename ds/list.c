@@ -4,13 +4,14 @@
 
 /* create an empty list */
 List *list_new(void) {
-	List *ls = malloc(sizeof(List));
+	List *ls = ds_malloc(sizeof(List));
 
 	/* check if malloc() succeeded */
 	if (ls == NULL)
 		return NULL;
 	/* empty list */
 	ls->head = NULL;
+	ls->tail = NULL;
 	ls->length = 0;
 	return ls;
 }
@@ -36,26 +37,22 @@ List *list_copy(List *orig) {
 
 /* add new node to end of list */
 Node *list_append(List *ls, void *data) {
-	Node *p, *n;
+	Node *n;
 
 	if (ls == NULL)
 		return NULL;
         /* prepare new node */
-        n = malloc(sizeof(Node));
+        n = ds_malloc(sizeof(Node));
         if (n == NULL)
                 return NULL;
         n->data = data;
         n->next = NULL;
 	/* make new head if empty list */
-	if (ls->head == NULL) {
+	if (ls->head == NULL)
 		ls->head = n;
-        } else {
-                /* insert it at the end */
-                for (p = ls->head; p->next; p = p->next)
-                        ;
-                /* link up */
-                p->next = n;
-        }
+        else
+                ls->tail->next = n;
+        ls->tail = n;
 	ls->length++;
 	return n;
 }
@@ -66,28 +63,21 @@ Node *list_prepend(List *ls, void *data) {
 
         if (ls == NULL)
                 return NULL;
-        n = malloc(sizeof(Node));
+        n = ds_malloc(sizeof(Node));
         if (n == NULL)
 		return NULL;
+	n->data = data;
 	n->next = ls->head;
 	ls->head = n;
+	if (ls->tail == NULL)
+		ls->tail = n;
 	ls->length++;
 	return n;
 }
 
 /* return the last node */
 Node *list_last(List *ls) {
-	Node *p;
-
-        if (ls == NULL)
-                return NULL;
-        /* empty list */
-	if (ls->head == NULL)
-		return NULL;
-	/* find last node */
-	for (p = ls->head; p->next; p = p->next)
-		;
-	return p;
+	return (ls == NULL) ? NULL : ls->tail;
 }
 
 /* return the first node */
@@ -145,6 +135,8 @@ void *list_remove(List *ls, void *data) {
 	if (ls->head->data == data) {
 		target = ls->head;
 		ls->head = target->next;
+		if (ls->tail == target)
+			ls->tail = NULL;
 		ls->length--;
 		free(target);
 		return data;
@@ -159,6 +151,8 @@ void *list_remove(List *ls, void *data) {
 	if (target == NULL)
 		return NULL;
 	p->next = target->next;
+	if (ls->tail == target)
+		ls->tail = p;
 	free(target);
 	ls->length--;
 	return data;
@@ -10,11 +10,12 @@ static void tree_print_helper(Tree *t, int depth);
 Tree *tree_new(void *data) {
         Tree *t;
 
-        t = malloc(sizeof(Tree));
+        t = ds_malloc(sizeof(Tree));
         if (t == NULL)
                 return NULL;
         t->parent = NULL;
         t->next = NULL;
+        t->prev = NULL;
         t->child = NULL;
         t->data = data;
         return t;
@@ -26,7 +27,7 @@ Tree *tree_insert_child(Tree *p, void *data) {
         if (p == NULL)
                 return NULL;
         /* prepare tree for insertion */
-        t = malloc(sizeof(Tree));
+        t = ds_malloc(sizeof(Tree));
         if (t == NULL)
                 return NULL;
         t->parent = p;
@@ -39,14 +40,36 @@ Tree *tree_insert_child(Tree *p, void *data) {
                 for (; sib->next; sib = sib->next)
                         ;
                 t->next = sib->next;
+                t->prev = sib;
                 sib->next = t;
         } else {
                 p->child = t;
                 t->next = NULL;
+                t->prev = NULL;
         }
         return t;
 }
 
+/* insert tree in front of the other children, in constant time */
+Tree *tree_push_child(Tree *p, void *data) {
+        Tree *t;
+
+        if (p == NULL)
+                return NULL;
+        t = ds_malloc(sizeof(Tree));
+        if (t == NULL)
+                return NULL;
+        t->parent = p;
+        t->child = NULL;
+        t->data = data;
+        t->next = p->child;
+        t->prev = NULL;
+        if (p->child != NULL)
+                p->child->prev = t;
+        p->child = t;
+        return t;
+}
+
 /* insert tree right after sibling */
 Tree *tree_insert_sib(Tree *sib, void *data) {
         Tree *t;
@@ -56,44 +79,38 @@ Tree *tree_insert_sib(Tree *sib, void *data) {
         if (sib->parent == NULL)
                 return NULL;
         /* prepare for insertion */
-        t = malloc(sizeof(Tree));
+        t = ds_malloc(sizeof(Tree));
         if (t == NULL)
                 return NULL;
         t->parent = sib->parent;
         t->next = sib->next;
+        t->prev = sib;
         t->child = NULL;
         t->data = data;
         /* insert after sibling */
+        if (sib->next != NULL)
+                sib->next->prev = t;
         sib->next = t;
         return t;
 }
 
-/* detach a tree from its parent and/or sibling */
+/* detach a tree from its parent and siblings, in constant time */
 Tree *tree_detach(Tree *t) {
-        Tree *p, *sib;
-
         if (t == NULL)
                 return NULL;
         /* disconnected adjacent trees */
         if (t->parent != NULL) {
-                p = t->parent;
-                sib = t->parent->child;
                 /* t is the first child or only child */
-                if (sib == t)
-                        p->child = t->next;
-                else {
-                        /* find the preceding sibling */
-                        for (; sib; sib = sib->next) {
-                                if (sib->next == t)
-                                        break;
-                        }
-                        if (sib == NULL)
-                                return NULL;
-                        sib->next = t->next;
-                }
+                if (t->prev == NULL)
+                        t->parent->child = t->next;
+                else
+                        t->prev->next = t->next;
+                if (t->next != NULL)
+                        t->next->prev = t->prev;
         }
         t->parent = NULL;
         t->next = NULL;
+        t->prev = NULL;
         return t;
 }
 
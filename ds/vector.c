@@ -0,0 +1,111 @@
+/* vector.c - growable arrays
+ * author: Eugene Ma (edma2) */
+#include "ds.h"
+
+static int vector_grow(Vector *v, int capacity);
+
+/* create an empty vector of elemsize byte items */
+Vector *vector_new(size_t elemsize) {
+        Vector *v;
+
+        v = ds_malloc(sizeof(Vector));
+        if (v == NULL)
+                return NULL;
+        vector_init(v, elemsize);
+        return v;
+}
+
+/* set up a vector that lives inside something else, it
+ * can't be moved while it keeps its items in place */
+void vector_init(Vector *v, size_t elemsize) {
+        v->elemsize = elemsize;
+        v->length = 0;
+        v->capacity = VECTOR_SMALL / elemsize;
+        v->items = v->small.bytes;
+}
+
+/* copy the item at elem to the end, return where it went */
+void *vector_push(Vector *v, void *elem) {
+        char *slot;
+
+        if (v == NULL)
+                return NULL;
+        if (v->length == v->capacity && vector_grow(v, v->capacity * 2) < 0)
+                return NULL;
+        slot = v->items + v->length * v->elemsize;
+        memcpy(slot, elem, v->elemsize);
+        v->length++;
+        return slot;
+}
+
+/* return the i'th item */
+void *vector_at(Vector *v, int i) {
+        if (v == NULL || i < 0 || i >= v->length)
+                return NULL;
+        return v->items + i * v->elemsize;
+}
+
+/* return the last item */
+void *vector_last(Vector *v) {
+        return vector_at(v, vector_size(v) - 1);
+}
+
+/* return the items, one after another */
+void *vector_data(Vector *v) {
+        return (v == NULL) ? NULL : v->items;
+}
+
+/* remove the last item */
+void vector_pop(Vector *v) {
+        if (v != NULL && v->length > 0)
+                v->length--;
+}
+
+/* remove every item but keep the room they took */
+void vector_clear(Vector *v) {
+        if (v != NULL)
+                v->length = 0;
+}
+
+int vector_size(Vector *v) {
+        if (v == NULL)
+                return -1;
+        return v->length;
+}
+
+/* free what a vector from vector_init holds */
+void vector_release(Vector *v) {
+        if (v == NULL)
+                return;
+        if (v->items != v->small.bytes)
+                free(v->items);
+        vector_init(v, v->elemsize);
+}
+
+void vector_free(Vector *v) {
+        if (v == NULL)
+                return;
+        vector_release(v);
+        free(v);
+}
+
+/* move the items to the heap once they outgrow the small buffer */
+static int vector_grow(Vector *v, int capacity) {
+        char *items;
+
+        if (capacity < 4)
+                capacity = 4;
+        if (v->items == v->small.bytes) {
+                items = ds_malloc(capacity * v->elemsize);
+                if (items == NULL)
+                        return -1;
+                memcpy(items, v->items, v->length * v->elemsize);
+        } else {
+                items = ds_realloc(v->items, capacity * v->elemsize);
+                if (items == NULL)
+                        return -1;
+        }
+        v->items = items;
+        v->capacity = capacity;
+        return 0;
+}
@@ -2,163 +2,347 @@
  * author: Eugene Ma (edma2) */
 
 /* TODO: 
-   error messages
-   remove trailing zeroes */
+   error messages */
 
-#define _GNU_SOURCE     // asprintf
 #include <ctype.h>
+#include <time.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
-#include "skm.h"
-
-#define INPUTMAX 300
-#define FILEINPUTMAX 2000
-
-typedef struct {
-	void *value;
-	int type;
-} Operand;
-
-int eval(Env *env, Expr *expr, void **result);
-int apply(Lambda *op, List *operands, void **result);
-int eval_lambda(Env *env, Expr *expr, void **result);
-int eval_define(Env *env, Expr *expr, void **result);
-int eval_if(Env *env, Expr *expr, void **result);
-int eval_cond(Env *env, Expr *expr, void **result);
-int eval_load(Env *env, Expr *expr, void **result);
-int is_atom(Expr *expr);
-int is_list(Expr *expr);
-int is_emptylist(Expr *expr);
-int is_num(char *atom);
-int is_quoted(char *atom);
-int is_define(Expr *expr);
-int is_lambda(Expr *expr);
-int is_load(Expr *expr);
-int is_display(Expr *expr);
-int is_begin(Expr *expr);
-int is_if(Expr *expr);
-int is_cond(Expr *expr);
-int is_prim(Lambda *b);
-
-int apply_primitive(Lambda *prim, List *operands, void **result);
-Env *env_setup_call(Lambda *op, List *operands);
-Bind *lookup(Env *env, char *symbol);
-Lambda *eval_operator(Env *env, Expr *expr);
-void op_free(Operand *op);
-void cleanup(Env *env);
-List *eval_operands(Env *env, Expr *expr);
-Operand *op_new(void *value, int type);
-
-static void init_primitives(Env *env);
-static void prim_add(Env *env, char *ident);
-static char *prim_get(Lambda *proc);
-static void op_free_helper(void *data);
-
-int main(void) {
+#include "eval.h"
+#include "prim.h"
+#include "gc.h"
+#include "vm.h"
+#include "opt.h"
+#include "prof.h"
+
+static void init_symbols(void);
+static int batch(Env *global, char **files, int nfiles, char **exprs, int nexprs,
+		int (*evaluate)(Env *, Expr *, Value *), int report);
+static int parse_only(Env *env, Expr *expr, Value *result);
+static int eval_form(Env *env, Expr *expr, int (*evaluate)(Env *, Expr *, Value *), Value *result);
+static int batch_stdin(Env *global, int (*evaluate)(Env *, Expr *, Value *));
+static int is_form(Expr *expr, int form);
+static int count_defines(Expr *expr);
+static int collect_defines(Expr *expr, Symbol **names, int n);
+static void proto_disown(Expr *expr);
+static int proto_nest(Expr *expr);
+static void proto_unnest(Expr *expr);
+static void resolve(Env *env, Proto *p, Expr *expr);
+static void resolve_atom(Env *env, Proto *p, Atom *atom);
+static void unresolve(Expr *expr);
+static int cache_new(void);
+static void values_free(int argc, Value *argv);
+
+/* keywords of the special forms */
+static Symbol *sym_else;
+/* The caches of resolved global references, an atom keeps
+ * the index of its own. Unused ones are linked through their
+ * version, and go back when the lambda form they're in does */
+static BindCache *caches = NULL;
+static int ncaches = 0, cachesmax = 0;
+static int cachefree = -1;
+/* if set, every top level form is timed as if it were in (time) */
+static int time_forms = 0;
+/* if set, every file that's loaded says how fast it went */
+int load_report = 0;
+
+int main(int argc, char **argv) {
 	Env *global;
 	Expr *expr;
-	Lambda *b;
-	char buf[INPUTMAX];
-	void *result = NULL;
+	Reader *reader;
+	Value result;
+	char **exprs;
+	int nexprs = 0;
 	int retval;
+	int opt;
+	int profile = 0;
+	/* tree walker unless -b asks for the bytecode vm */
+	int (*evaluate)(Env *, Expr *, Value *) = eval;
+
+	exprs = ds_malloc(argc * sizeof(char *));
+	if (exprs == NULL)
+		return -1;
+	while ((opt = getopt(argc, argv, "bpdtPF:e:")) != -1) {
+		if (opt == 'b') {
+			evaluate = vm_eval;
+		} else if (opt == 'p') {
+			evaluate = parse_only;
+		} else if (opt == 'd') {
+			opt_dump = 1;
+		} else if (opt == 't') {
+			time_forms = 1;
+		} else if (opt == 'P') {
+			profile = 1;
+		} else if (opt == 'F') {
+			prof_folded = optarg;
+		} else if (opt == 'e') {
+			exprs[nexprs++] = optarg;
+		} else {
+			fprintf(stderr, "usage: %s [-b] [-p] [-d] [-t] [-P] [-F file] [-e expr] [file ...]\n", argv[0]);
+			return 1;
+		}
+	}
 
 	global = env_new();
-	if (global == NULL)
+	if (global == NULL || port_init() < 0)
+		return -1;
+	gc_init(global);
+	init_symbols();
+	prim_init(global);
+	/* cleanup reports it */
+	if (profile)
+		prof_begin();
+	/* run what we were given and leave */
+	if (optind < argc || nexprs > 0) {
+		/* -p times the reader on its own */
+		load_report = (evaluate == parse_only);
+		if (load_report)
+			fprintf(stderr, "lexer: %s\n", lex_name());
+		retval = batch(global, argv + optind, argc - optind, exprs, nexprs, 
+				evaluate, load_report);
+		free(exprs);
+		cleanup(global);
+		return (retval == RETVAL_ERROR) ? 1 : 0;
+	}
+	free(exprs);
+	/* expressions can span lines or share them */
+	reader = reader_new(STDIN_FILENO);
+	if (reader == NULL)
 		return -1;
-	init_primitives(global);
 	while (1) {
 		/* display useful information and prompt */
-		printf("skm> ");
-		/* get input */
-		if (fgets(buf, INPUTMAX, stdin) == NULL)
+		port_puts(port_stdout, "skm> ");
+		port_flush(port_stdout);
+		/* get input, parse and evaluate, store value in result */
+		retval = reader_next(reader, &expr);
+		if (retval == 0)
 			break;
-		buf[strlen(buf)-1] = '\0';
-		/* parse and evaluate, store value in result */
-		expr = parse(buf);
-		if (expr == NULL) {
-			expr_free(expr);
+		if (retval < 0)
 			continue;
-		}
-		retval = eval(global, expr, &result);
+		retval = eval_form(global, expr, evaluate, &result);
 		/* check return value and print output */
-		if (retval == RETVAL_ATOM) {
-			printf("%s", (char *)result);
-			free(result);
-		} else if (retval == RETVAL_LAMBDA) {
-			b = (Lambda *)result;
-			lambda_print(b);
-			/* remove lambda if we didn't bind it immediately */
-                        lambda_check_remove(b);
+		if (retval != RETVAL_ERROR) {
+			value_print(port_stdout, result);
+			value_free(result);
                 }
 		expr_free(expr);
-                /* clean up environment */
-		env_sweep_frames(global);
                 if (retval != RETVAL_ERROR)
-                        printf("\n");
+                        port_puts(port_stdout, "\n");
 	}
+        reader_free(reader);
+        port_puts(port_stdout, "\n");
         cleanup(global);
-        printf("\n");
 	return 0;
 }
 
-int eval(Env *env, Expr *expr, void **result) {
-	Lambda *proc;
-	List *operands;
-	Bind *bind;
+/* Evaluate the files and then the expressions without a prompt
+ * or printing their values, the first error stops everything. 
+ * A file named - is standard input. If report is set, say how
+ * long each file took */
+static int batch(Env *global, char **files, int nfiles, char **exprs, int nexprs,
+		int (*evaluate)(Env *, Expr *, Value *), int report) {
+	int forms = 0;
+	int i;
+
+	for (i = 0; i < nfiles; i++) {
+		if (strcmp(files[i], "-") == 0) {
+			if (batch_stdin(global, evaluate) == RETVAL_ERROR)
+				return RETVAL_ERROR;
+		} else if (load_file(global, files[i], evaluate, report) == RETVAL_ERROR) {
+			return RETVAL_ERROR;
+		}
+	}
+	for (i = 0; i < nexprs; i++) {
+		if (load_buffer(global, exprs[i], strlen(exprs[i]), evaluate, &forms) == RETVAL_ERROR)
+			return RETVAL_ERROR;
+	}
+	return RETVAL_ATOM;
+}
+
+/* evaluate a top level form once the optimizer has been over it */
+static int eval_form(Env *env, Expr *expr, int (*evaluate)(Env *, Expr *, Value *), Value *result) {
+	Usage start;
 	int retval;
-	char *atom;
 
-	if (env == NULL || expr == NULL)
+	if (evaluate == parse_only)
+		return evaluate(env, expr, result);
+	if (time_forms)
+		usage_get(&start);
+	optimize(env, expr);
+	retval = evaluate(env, expr, result);
+	if (time_forms && retval != RETVAL_ERROR)
+		usage_report(&start);
+	return retval;
+}
+
+/* an evaluator that doesn't, for timing the reader */
+static int parse_only(Env *env, Expr *expr, Value *result) {
+	*result = VALUE_EMPTY;
+	return RETVAL_ATOM;
+}
+
+static int batch_stdin(Env *global, int (*evaluate)(Env *, Expr *, Value *)) {
+	Reader *reader;
+	Expr *expr;
+	Value result;
+	int retval = RETVAL_ATOM;
+	int status;
+
+	reader = reader_new(STDIN_FILENO);
+	if (reader == NULL)
 		return RETVAL_ERROR;
-	if (is_atom(expr)) {
-                /* self evaluating */
-		atom = expr_get_word(expr);
-		if (is_num(atom)) {
-			*result = strdup(atom);
-			return RETVAL_ATOM;
-		} else if (is_quoted(atom)) {
-			*result = strdup(atom + 1);
-			return RETVAL_ATOM;
-		} else {
-                        /* lookup symbol */
-			if ((bind = lookup(env, atom)) == NULL)
-				return RETVAL_ERROR;
-			if (bind->type == RETVAL_ATOM)
-				*result = strdup((char *)bind->value);
-			else
-				*result = bind->value;
-			return bind->type;
+	while ((status = reader_next(reader, &expr)) > 0) {
+		retval = eval_form(global, expr, evaluate, &result);
+		expr_free(expr);
+		if (retval == RETVAL_ERROR)
+			break;
+		value_free(result);
+	}
+	if (status < 0)
+		retval = RETVAL_ERROR;
+	reader_free(reader);
+	return retval;
+}
+
+/* Evaluate expr in env. Tail positions don't recurse: the branch
+ * or body to evaluate next replaces expr and we go around again, so
+ * loops written as tail calls run in constant C stack */
+int eval(Env *env, Expr *expr, Value *result) {
+	Lambda *proc = NULL;
+	/* the lambda whose body we're in and the frame we made for it */
+	Lambda *current = NULL;
+	Env *owned = NULL;
+	Env *callenv;
+	/* the argument window, a handful of operands fit in place */
+	Vector operands;
+	Bind *bind;
+	int retval = RETVAL_ERROR;
+	int roots;
+
+	/* the collector may run whenever a lambda or frame is made */
+	roots = gc_root(ROOT_ENV, &env);
+	gc_root(ROOT_LAMBDA, &proc);
+	gc_root(ROOT_LAMBDA, &current);
+	vector_init(&operands, sizeof(Value));
+	gc_root(ROOT_OPERANDS, &operands);
+	for (;;) {
+		if (env == NULL || expr == NULL) {
+			retval = RETVAL_ERROR;
+			break;
 		}
-	} else {
-                /* special forms */
-                if (is_define(expr)) {
-			return eval_define(env, expr, result);
+		if (is_atom(expr)) {
+			/* self evaluating */
+			if (expr_kind(expr) == EXPR_NUM || expr_kind(expr) == EXPR_BOOL) {
+				*result = expr_get_value(expr);
+				retval = RETVAL_ATOM;
+			} else if (expr_kind(expr) == EXPR_STRING) {
+				*result = value_string(expr_get_word(expr) + 1);
+				retval = RETVAL_ATOM;
+			} else {
+				/* lookup symbol */
+				bind = lookup(env, expr_get_atom(expr));
+				if (bind == NULL || bind->value == VALUE_UNBOUND) {
+					fprintf(stderr, "skm: unbound variable %s\n", expr_get_word(expr));
+					retval = RETVAL_ERROR;
+					break;
+				}
+				*result = value_copy(bind->value);
+				retval = value_type(*result);
+			}
+			break;
+		}
+		if (is_emptylist(expr)) {
+			*result = VALUE_NIL;
+			retval = RETVAL_ATOM;
+			break;
+		}
+		if (is_folded(env, expr)) {
+			*result = expr->fold.value;
+			retval = RETVAL_ATOM;
+			break;
+		}
+		/* special forms */
+		if (is_define(expr)) {
+			retval = eval_define(env, expr, result);
+			break;
 		} else if (is_lambda(expr)) {
-			return eval_lambda(env, expr, result);
-                } else if (is_if(expr)) {
-                        return eval_if(env, expr, result);
-                } else if (is_cond(expr)) {
-                        return eval_cond(env, expr, result);
-                } else if (is_load(expr)) {
-                        return eval_load(env, expr, result);
-		} else {
-                        /* application */
-			proc = eval_operator(env, expr);
-			if (proc == NULL)
-				return RETVAL_ERROR;
-			operands = eval_operands(env, expr);
-			if (operands == NULL)
-				return RETVAL_ERROR;
-			retval = apply(proc, operands, result);
-			/* cleanup application */
-                        lambda_check_remove(proc);
-			list_traverse(operands, op_free_helper);
-			list_free(operands);
-			return retval;
+			retval = eval_lambda(env, expr, result);
+			break;
+		} else if (is_load(expr)) {
+			retval = eval_load(env, expr, result);
+			break;
+		} else if (is_time(expr)) {
+			retval = eval_time(env, expr, result);
+			break;
+		} else if (is_profile(expr)) {
+			retval = eval_profile(env, expr, result);
+			break;
+		} else if (is_quote(expr)) {
+			retval = quote_value(expr_next(expr_child(expr)), result);
+			break;
+		} else if (is_if(expr) || is_cond(expr) || is_begin(expr)) {
+			if (is_if(expr))
+				retval = eval_if(env, expr, &expr);
+			else if (is_cond(expr))
+				retval = eval_cond(env, expr, &expr);
+			else
+				retval = eval_begin(env, expr, &expr);
+			if (retval == RETVAL_ERROR)
+				break;
+			/* nothing left to evaluate */
+			if (expr == NULL) {
+				*result = VALUE_EMPTY;
+				retval = RETVAL_ATOM;
+				break;
+			}
+			continue;
+		}
+		/* application */
+		proc = eval_operator(env, expr);
+		if (proc == NULL) {
+			retval = RETVAL_ERROR;
+			break;
+		}
+		if (eval_operands(env, expr, &operands) < 0) {
+			retval = RETVAL_ERROR;
+			break;
+		}
+		if (is_prim(proc) || proc->code != NULL) {
+			retval = apply(proc, vector_size(&operands), 
+					vector_data(&operands), result);
+			vector_clear(&operands);
+			break;
+		}
+		callenv = env_setup_call(proc, vector_size(&operands), 
+				vector_data(&operands));
+		if (callenv == NULL) {
+			operands_clear(&operands);
+			retval = RETVAL_ERROR;
+			break;
+		}
+		/* the new frame took the operands over */
+		vector_clear(&operands);
+		/* the body we run belongs to current, and 
+		 * the frame we leave is done with */
+		if (prof_on) {
+			if (current != NULL)
+				prof_tail(proc);
+			else
+				prof_enter(proc);
 		}
+		current = proc;
+		env_release(owned);
+		owned = env = callenv;
+		expr = proc->body;
 	}
-	return RETVAL_ERROR;
+	gc_unroot(roots);
+	vector_release(&operands);
+	env_release(owned);
+	if (prof_on && current != NULL)
+		prof_exit();
+	return retval;
 }
 
 /* Return non-zero if the Expression is not a list */
@@ -176,48 +360,14 @@ int is_list(Expr *expr) {
 	return expr_is_list(expr);
 }
 
-/* Return non-zero if the string is real number */
-int is_num(char *atom) {
-	int decimalcount = 0;
-
-	/* error */
-	if (atom == NULL || *atom == '\0')
-		return 0;
-	/* check sign */
-	if (*atom == '-') {
-                if (*(atom + 1) == '\0')
-                        return 0;
-		atom++;
-        }
-	/* check each char */
-	for (; *atom != '\0'; atom++) {
-		if (*atom == '.') {
-			if (++decimalcount > 1)
-				break;
-                        /* TODO: remove trailing zeroes */
-		} else if (!isdigit(*atom)) {
-			break;
-		}
-	}
-	/* return true if we reached the end of the string */
-	return (*atom == '\0') ? 1 : 0;
-}
-
-/* Return non-zero if the first char is a single quote */
-int is_quoted(char *atom) {
-	if (atom == NULL)
-		return 0;
-	if (*atom == '\'' || *atom == '\"')
-                return 1;
-        return 0;
+/* Return non-zero if the expression is the given special form,
+ * which the reader found out from its first word */
+static int is_form(Expr *expr, int form) {
+	return (expr_form(expr) == form);
 }
 
 int is_if(Expr *expr) {
-	if (expr == NULL)
-		return 0;
-        if (!is_atom(expr_child(expr)))
-                return 0;
-        if (strcmp(expr_get_word(expr_child(expr)), "if"))
+        if (!is_form(expr, FORM_IF))
                 return 0;
 	/* must consist of at least 3 atoms */
 	if (expr_len(expr) < 3) {
@@ -228,11 +378,7 @@ int is_if(Expr *expr) {
 }
 
 int is_cond(Expr *expr) {
-        if (expr == NULL)
-                return 0;
-        if (!is_atom(expr_child(expr)))
-                return 0;
-        if (strcmp(expr_get_word(expr_child(expr)), "cond"))
+        if (!is_form(expr, FORM_COND))
                 return 0;
         /* should have at least one condition */
         if (expr_len(expr) < 2) {
@@ -249,9 +395,55 @@ int is_load(Expr *expr) {
 	if (expr_len(expr) != 2)
 		return 0;
 	/* check the first word of the expression tree */
-        if (!is_atom(expr_child(expr)))
-                return 0;
-	return (!strcmp(expr_get_word(expr_child(expr)), "load"));
+	return is_form(expr, FORM_LOAD);
+}
+
+/* Return non-zero if the expression is a sequence */
+int is_begin(Expr *expr) {
+	if (expr_len(expr) < 2)
+		return 0;
+	return is_form(expr, FORM_BEGIN);
+}
+
+/* Return non-zero if the expression is (time expr) */
+int is_time(Expr *expr) {
+	if (expr_len(expr) != 2)
+		return 0;
+	return is_form(expr, FORM_TIME);
+}
+
+/* Return non-zero if the expression is (profile expr) */
+int is_profile(Expr *expr) {
+	if (expr_len(expr) != 2)
+		return 0;
+	return is_form(expr, FORM_PROFILE);
+}
+
+/* Return non-zero if the expression is (quote datum) */
+int is_quote(Expr *expr) {
+	if (expr_len(expr) != 2)
+		return 0;
+	return is_form(expr, FORM_QUOTE);
+}
+
+/* Return non-zero if the expression is a call that was folded
+ * and its operator, and those of the folded calls among its
+ * operands, still run the primitives they were folded with.
+ * Then its value can be used instead, otherwise it's a call */
+int is_folded(Env *env, Expr *expr) {
+	Expr *e;
+	Bind *bind;
+
+	if (!is_form(expr, FORM_FOLDED))
+		return 0;
+	bind = lookup(env, expr_get_atom(expr_child(expr)));
+	if (bind == NULL || !calls_prim(bind->value, expr->fold.prim))
+		return 0;
+	for (e = expr_next(expr_child(expr)); e; e = expr_next(e)) {
+		if (is_form(e, FORM_FOLDED) && !is_folded(env, e))
+			return 0;
+	}
+	return 1;
 }
 
 /* Return non-zero if the expression is a define evaluation */
@@ -262,9 +454,7 @@ int is_define(Expr *expr) {
 	if (expr_len(expr) != 3)
 		return 0;
 	/* check the first word of the expression tree */
-        if (!is_atom(expr_child(expr)))
-                return 0;
-	return (!strcmp(expr_get_word(expr_child(expr)), "define"));
+	return is_form(expr, FORM_DEFINE);
 }
 
 /* Return non-zero if the expression is a lambda evaluation */
@@ -274,161 +464,260 @@ int is_lambda(Expr *expr) {
 	/* must consist of at least 3 symbols */
 	if (expr_len(expr) != 3)
 		return 0;
-        if (!is_atom(expr_child(expr)))
-                return 0;
-	return (!strcmp(expr_get_word(expr_child(expr)), "lambda"));
+	return is_form(expr, FORM_LAMBDA);
 }
 
 /* Returns non-zero if the lambda is a primitive procedure.
- * A primitive operator is implemented by a lambda with
- * a NULL body expression. The primitive's param expression
- * is replaced by a identifying string instead of a set of 
- * parameters */
+ * A primitive operator is implemented by a lambda with no
+ * body that points to its descriptor in the primitive table */
 int is_prim(Lambda *b) {
 	if (b == NULL)
 		return -1;
-	return (b->body == NULL);
+	return (b->prim != NULL);
 }
 
-/* Return the primitive procedure's identifier */
-static char *prim_get(Lambda *proc) {
-	if (proc == NULL)
-		return NULL;
-	return expr_get_word(proc->param);
-}
-
-/* Populate the initial environment with primitive procedures */
-static void init_primitives(Env *env) {
-	if (env == NULL)
-		return;
-	prim_add(env, "+");
-	prim_add(env, "*");
-	prim_add(env, "/");
-	prim_add(env, "-");
-	prim_add(env, "=");
-	prim_add(env, ">");
-	prim_add(env, "<");
-	prim_add(env, "<=");
-	prim_add(env, ">=");
-	prim_add(env, "begin");
-	prim_add(env, "display");
-	prim_add(env, "newline");
-	/* please add a few more... */
-}
-
-/* Add a primitive */
-static void prim_add(Env *env, char *ident) {
-	Lambda *proc;
-	Expr *identifier;
-	Bind *bind;
+/* Return non-zero if the expression is the else of a cond clause */
+int is_else(Expr *expr) {
+	return (is_atom(expr) && expr_get_symbol(expr) == sym_else);
+}
 
-	identifier = parse(ident);
-	/* param looks like this:
-	 *\+
-	 */
-	if (identifier == NULL)
-		return;
-	proc = lambda_new(env, NULL, identifier);
-	if (proc == NULL) {
-		expr_free(identifier);
-		return;
-	}
-	bind = bind_new(ident, proc, RETVAL_LAMBDA);
-	if (bind == NULL) {
-		lambda_free(proc);
-		return;
-	}
-	if (bind_add(env, bind) == NULL) {
-		bind_free(bind);
-		return;
+/* Mark the keywords of the special forms, so the reader can
+ * tag every list that starts with one as it goes */
+static void init_symbols(void) {
+	static struct {
+		char *name;
+		int form;
+	} keywords[] = {
+		{ "define", FORM_DEFINE },
+		{ "lambda", FORM_LAMBDA },
+		{ "if", FORM_IF },
+		{ "cond", FORM_COND },
+		{ "load", FORM_LOAD },
+		{ "begin", FORM_BEGIN },
+		{ "time", FORM_TIME },
+		{ "profile", FORM_PROFILE },
+		{ "quote", FORM_QUOTE }
+	};
+	Symbol *sym;
+	int i;
+
+	for (i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++) {
+		if ((sym = intern(keywords[i].name)) != NULL)
+			sym->form = keywords[i].form;
 	}
+	sym_else = intern("else");
 }
 
-int eval_load(Env *env, Expr *expr, void **result) {
-        char buf[FILEINPUTMAX];
-        int fd;
-        char *filename;
-        void *fileaddr;
-        Expr *fileexpr;
+int eval_load(Env *env, Expr *expr, Value *result) {
         int retval;
 
         /* check return value - must be ATOM */
         retval = eval(env, expr_next(expr_child(expr)), result);
-        if (retval == RETVAL_LAMBDA) {
-                lambda_check_remove((Lambda *)*result);
+        if (retval == RETVAL_ERROR)
                 return RETVAL_ERROR;
-        } else if (retval == RETVAL_ERROR) {
+        if (value_tag(*result) != TAG_STRING) {
+                value_free(*result);
                 return RETVAL_ERROR;
         }
+        retval = load(env, value_get_string(*result), eval, load_report, result);
+        return retval;
+}
+
+/* evaluate expr and say what it cost on stderr */
+int eval_time(Env *env, Expr *expr, Value *result) {
+	Usage start;
+	int retval;
+
+	usage_get(&start);
+	retval = eval(env, expr_next(expr_child(expr)), result);
+	if (retval != RETVAL_ERROR)
+		usage_report(&start);
+	return retval;
+}
+
+/* evaluate expr and report the calls it made on stderr, a
+ * profile already being taken just carries on through it */
+int eval_profile(Env *env, Expr *expr, Value *result) {
+	int retval;
+
+	prof_begin();
+	retval = eval(env, expr_next(expr_child(expr)), result);
+	prof_end();
+	return retval;
+}
+
+/* The value a quoted datum stands for. Words are strings
+ * the way 'word is, and a list is made of new pairs every
+ * time, the one being built is a root while it grows */
+int quote_value(Expr *datum, Value *result) {
+	Value list = VALUE_NIL, elem = VALUE_NIL;
+	Pair *p, *last = NULL;
+	Expr *e;
+	int roots;
+
+	switch (expr_kind(datum)) {
+	case EXPR_NUM:
+	case EXPR_BOOL:
+		*result = expr_get_value(datum);
+		return RETVAL_ATOM;
+	case EXPR_STRING:
+		*result = value_string(expr_get_word(datum) + 1);
+		return RETVAL_ATOM;
+	case EXPR_SYMBOL:
+		*result = value_string(expr_get_word(datum));
+		return RETVAL_ATOM;
+	}
+	roots = gc_root(ROOT_VALUE, &list);
+	gc_root(ROOT_VALUE, &elem);
+	for (e = expr_child(datum); e; e = expr_next(e)) {
+		if (quote_value(e, &elem) == RETVAL_ERROR)
+			break;
+		p = pair_new(elem, VALUE_NIL);
+		if (p == NULL) {
+			value_free(elem);
+			fprintf(stderr, "skm: out of memory\n");
+			break;
+		}
+		elem = VALUE_NIL;
+		if (last == NULL)
+			list = value_ptr(TAG_PAIR, p);
+		else
+			last->cdr = value_ptr(TAG_PAIR, p);
+		last = p;
+	}
+	gc_unroot(roots);
+	/* what was made so far is the collector's to free */
+	if (e != NULL)
+		return RETVAL_ERROR;
+	*result = list;
+	return RETVAL_ATOM;
+}
+
+/* Evaluate a file with the given evaluator, the filename is
+ * released. Its forms are top level ones wherever the load is,
+ * so they run in the global env. If report is set, say how
+ * long it took */
+int load(Env *env, char *filename, int (*evaluate)(Env *, Expr *, Value *), 
+                int report, Value *result) {
+        int retval;
+
+        retval = load_file(env_global(env), filename, evaluate, report);
+        free(filename);
+        if (retval == RETVAL_ERROR)
+                return RETVAL_ERROR;
+        /* return value is an atom */
+        *result = value_string("'done");
+        return RETVAL_ATOM;
+}
+
+/* Evaluate every top level form of a file in order, the
+ * first one that fails stops it. If report is set, print
+ * how long it took */
+int load_file(Env *env, char *filename, int (*evaluate)(Env *, Expr *, Value *), int report) {
+        struct stat st;
+        struct timespec start, end;
+        char *fileaddr;
+        double secs;
+        int fd, forms = 0;
+        int retval;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
         /* open file */
-        filename = (char *)*result;
         fd = open(filename, O_RDONLY, 0);
-        free(*result);
-        if (fd < 0) {
-                fprintf(stderr, "error opening file\n");
+        if (fd < 0 || fstat(fd, &st) < 0) {
+                fprintf(stderr, "error opening file %s\n", filename);
+                if (fd >= 0)
+                        close(fd);
                 return RETVAL_ERROR;
         }
-        /* get pointer to file */
-        fileaddr = mmap(NULL, FILEINPUTMAX, PROT_READ, MAP_SHARED, fd, 0);
+        /* map all of it, the forms are read in place */
+        fileaddr = NULL;
+        if (st.st_size > 0) {
+                fileaddr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (fileaddr == MAP_FAILED) {
+                        fprintf(stderr, "error mapping file %s\n", filename);
+                        close(fd);
+                        return RETVAL_ERROR;
+                }
+                madvise(fileaddr, st.st_size, MADV_SEQUENTIAL);
+        }
         close(fd);
-        if (fileaddr == NULL)
-                return RETVAL_ERROR;
-        /* copy file to buffer */
-        if (!memcpy(buf, fileaddr, FILEINPUTMAX))
-                return RETVAL_ERROR;
-        /* evaluate file stored in buffer */
-        fileexpr = parse(buf);
-        if (fileexpr == NULL)
-                return RETVAL_ERROR;
-        retval = eval(env, fileexpr, result);
-        expr_free(fileexpr);
-        /* clean up result */
-        if (retval == RETVAL_ATOM)
-                free(*result);
-        else if (retval == RETVAL_LAMBDA)
-                lambda_check_remove((Lambda *)*result);
-        else
+        retval = load_buffer(env, fileaddr, st.st_size, evaluate, &forms);
+        if (fileaddr != NULL)
+                munmap(fileaddr, st.st_size);
+        if (report) {
+                clock_gettime(CLOCK_MONOTONIC, &end);
+                secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+                fprintf(stderr, "load: %s: %d forms, %ld bytes in %.3f s (%.2f MB/s)\n",
+                                filename, forms, (long)st.st_size, secs, 
+                                (secs > 0) ? st.st_size / secs / 1e6 : 0.0);
+        }
+        return retval;
+}
+
+/* Evaluate the forms in the n bytes at buf, *forms counts 
+ * the ones that were */
+int load_buffer(Env *env, char *buf, size_t n, int (*evaluate)(Env *, Expr *, Value *), int *forms) {
+        Reader *reader;
+        Expr *expr;
+        Value result;
+        size_t off = 0, used;
+        int retval = RETVAL_ATOM;
+        int status;
+
+        reader = reader_new(-1);
+        if (reader == NULL)
                 return RETVAL_ERROR;
-        /* return value is an atom */
-        *result = strdup("'done");
-        return RETVAL_ATOM;
+        while (off < n) {
+                status = reader_feed(reader, buf + off, n - off, &used, &expr);
+                off += used;
+                /* a word can end the input */
+                if (status == 0)
+                        status = reader_end(reader, &expr);
+                if (status <= 0) {
+                        if (status < 0)
+                                retval = RETVAL_ERROR;
+                        break;
+                }
+                retval = eval_form(env, expr, evaluate, &result);
+                expr_free(expr);
+                if (retval == RETVAL_ERROR)
+                        break;
+                value_free(result);
+                (*forms)++;
+        }
+        reader_free(reader);
+        return retval;
 }
 
-/* Evaluate if statement */
-int eval_if(Env *env, Expr *expr, void **result) {
+/* Evaluate the predicate of an if statement and set 
+ * *branch to the branch that should be evaluated next */
+int eval_if(Env *env, Expr *expr, Expr **branch) {
         Expr *predicate;
-        Expr *true, *false;
+        Expr *consequent, *alternative;
+        Value result;
         int retval;
         int boolean;
 
         predicate = expr_next(expr_child(expr));
-        true = expr_next(expr_next(expr_child(expr)));
-        false = expr_next(expr_next(expr_next(expr_child(expr))));
-        retval = eval(env, predicate, result);
-        /* clean up result */
-        if (retval == RETVAL_ATOM) {
-                boolean = strcmp((char *)*result, "#f");
-                free(*result);
-        } else if (retval == RETVAL_LAMBDA) {
-                lambda_check_remove((Lambda *)*result);
-                boolean = 0;
-        } else {
+        consequent = expr_next(expr_next(expr_child(expr)));
+        alternative = expr_next(expr_next(expr_next(expr_child(expr))));
+        retval = eval(env, predicate, &result);
+        if (retval == RETVAL_ERROR)
                 return RETVAL_ERROR;
-        }
+        /* everything but #f is true */
+        boolean = (result != VALUE_FALSE);
+        value_free(result);
         /* false statement is optional */
-        if (boolean) {
-                return eval(env, true, result);
-        } else {
-                if (false == NULL) {
-                        *result = strdup("\0");
-                        return RETVAL_ATOM;
-                }
-                return eval(env, false, result);
-        }
+        *branch = (boolean) ? consequent : alternative;
+        return RETVAL_ATOM;
 }
 
-int eval_cond(Env *env, Expr *expr, void **result) {
-        Expr *clause, *predicate, *true;
+/* Find the clause whose predicate holds and set *branch
+ * to its expression, NULL if none of them do */
+int eval_cond(Env *env, Expr *expr, Expr **branch) {
+        Expr *clause, *predicate;
+        Value result;
         int retval;
 
         /* find the right clause to evaluate */
@@ -439,7 +728,7 @@ int eval_cond(Env *env, Expr *expr, void **result) {
                 }
                 predicate = expr_child(clause);
                 /* skip if "else" */
-                if (is_atom(predicate) && !strcmp(expr_get_word(predicate), "else")) { 
+                if (is_else(predicate)) { 
                         if (expr_next(clause)) {
                                 fprintf(stderr, "cond: misplaced else clause\n");
                                 return RETVAL_ERROR;
@@ -447,46 +736,64 @@ int eval_cond(Env *env, Expr *expr, void **result) {
                         break;
                 }
                 /* evaluate predicate */
-                retval = eval(env, predicate, result);
-                /* check and cleanup returned values */
-                if (retval == RETVAL_ATOM) {
-                        /* break out of loop if it doesn't equal #f */
-                        if (strcmp((char *)*result, "#f")) {
-                                free(*result);
-                                break;
-                        }
-                        free(*result);
-                } else if (retval == RETVAL_LAMBDA) {
-                        /* break out of loop is lambda */
-                        lambda_check_remove((Lambda *)*result);
+                retval = eval(env, predicate, &result);
+                if (retval == RETVAL_ERROR)
+                        return RETVAL_ERROR;
+                /* break out of loop if it doesn't equal #f */
+                value_free(result);
+                if (result != VALUE_FALSE)
                         break;
-                } else {
+        }
+        /* no clause matched */
+        *branch = (clause) ? expr_next(expr_child(clause)) : NULL;
+        return RETVAL_ATOM;
+}
+
+/* Evaluate all but the last expression of a begin, 
+ * which is left in *last */
+int eval_begin(Env *env, Expr *expr, Expr **last) {
+        Value result;
+
+        for (expr = expr_next(expr_child(expr)); expr_next(expr); expr = expr_next(expr)) {
+                if (eval(env, expr, &result) == RETVAL_ERROR)
                         return RETVAL_ERROR;
-                }
+                value_free(result);
         }
-        true = expr_next(expr_child(clause));
-        retval = eval(env, true, result);
-        return retval;
+        *last = expr;
+        return RETVAL_ATOM;
 }
 
-/* Evaluate lambda statement */
-int eval_lambda(Env *env, Expr *expr, void **result) {
-	Expr *param;
-	Expr *body;
+/* Evaluate lambda statement. A lambda form inside the body of
+ * another one has its code made once, when the outer one was */
+int eval_lambda(Env *env, Expr *expr, Value *result) {
+	Proto *proto;
 	Lambda *lambda;
 
-	/* extract parameters and body */
-	param = expr_next(expr_child(expr));
-	body = expr_next(expr_next(expr_child(expr)));
-	/* create a lambda from the obtained expressions */
-	lambda = lambda_new(env, body, param);
-	*result = lambda;
+	proto = expr->proto;
+	if (proto != NULL) {
+		lambda = lambda_new(env, proto);
+	} else {
+		/* nobody will see this form again */
+		proto = proto_new(expr);
+		if (proto == NULL)
+			return RETVAL_ERROR;
+		lambda = lambda_new(env, proto);
+		proto_release(proto);
+	}
+	if (lambda == NULL)
+		return RETVAL_ERROR;
+	/* every closure of a form sees the same frames */
+	if (!proto->resolved) {
+		resolve(env, proto, proto->body);
+		proto->resolved = 1;
+	}
+	*result = value_ptr(TAG_LAMBDA, lambda);
 	return RETVAL_LAMBDA;
 }
 
 /* Evaluate define statement */
-int eval_define(Env *env, Expr *expr, void **result) {
-	char *dsymbol, *dvalue;
+int eval_define(Env *env, Expr *expr, Value *result) {
+	Atom *datom;
 	int retval;
 	Bind *bind;
 	Expr *dexpr;
@@ -497,10 +804,19 @@ int eval_define(Env *env, Expr *expr, void **result) {
 	if (retval == RETVAL_ERROR)
 		return RETVAL_ERROR;
 	/* get symbol and value */
-	dsymbol = expr_get_word(expr_next(expr_child(expr)));
-	dvalue = *result;
+	datom = expr_get_atom(expr_next(expr_child(expr)));
+	if (datom == NULL || expr_is_list(expr_next(expr_child(expr)))) {
+		value_free(*result);
+		return RETVAL_ERROR;
+	}
+	lambda_name(*result, datom->symbol);
+	/* the slot was laid out when the lambda was created */
+	if (datom->depth == 0) {
+		bind_set(frame_slot(env, 0, datom->slot), *result);
+		return retval;
+	}
 	/* create binding */
-	bind = bind_new(dsymbol, dvalue, retval);
+	bind = bind_new(datom->symbol, *result);
 	if (bind == NULL)
 		return RETVAL_ERROR;
 	/* add binding to environment */
@@ -511,163 +827,42 @@ int eval_define(Env *env, Expr *expr, void **result) {
 	return retval;
 }
 
-/* eval/apply loop */
-int apply(Lambda *op, List *operands, void **result) {
-        Env *env;
-
-	if (is_prim(op))
-                return apply_primitive(op, operands, result);
-        env = env_setup_call(op, operands);
-        if (env == NULL)
-                return RETVAL_ERROR;
-        return eval(env, op->body, result);
-}
+/* Apply a primitive to the argc values at argv, which are used
+ * up whether or not it succeeds. Lambdas are applied by eval's
+ * own loop, so any other procedure here is a compiled one */
+int apply(Lambda *op, int argc, Value *argv, Value *result) {
+        int retval = RETVAL_ERROR;
 
-/* primitives library */
-int apply_primitive(Lambda *prim, List *operands, void **result) {
-        Node *p;
-	float f = 0;
-        int boolean;
-        Operand *comparable;
-        Operand *first, *last;
-
-        /* basic arithmetic */
-        if (!strcmp(prim_get(prim), "+")) {
-                for (p = list_first(operands); p; p = p->next)
-                        f += atof(((Operand *)p->data)->value);
-                asprintf((char **)result, "%f", f);
-                return RETVAL_ATOM;
-        } else if (!strcmp(prim_get(prim), "-")) {
-                p = list_first(operands);
-                f = atof(((Operand *)p->data)->value);
-                for (p = p->next; p; p = p->next)
-                        f -= atof(((Operand *)p->data)->value);
-                asprintf((char **)result, "%f", f);
-                return RETVAL_ATOM;
-        } else if (!strcmp(prim_get(prim), "*")) {
-                f = 1;
-                for (p = list_first(operands); p; p = p->next)
-                        f *= atof(((Operand *)p->data)->value);
-                asprintf((char **)result, "%f", f);
-                return RETVAL_ATOM;
-        } else if (!strcmp(prim_get(prim), "/")) {
-                p = list_first(operands);
-                f = atof(((Operand *)p->data)->value);
-                for (p = p->next; p; p = p->next)
-                        f /= atof(((Operand *)p->data)->value);
-                asprintf((char **)result, "%f", f);
-                return RETVAL_ATOM;
-        } else if (!strcmp(prim_get(prim), "=")) {
-                if (list_size(operands) == 0) {
-                        fprintf(stderr, "skm: wrong number of arguments\n");
-                        return RETVAL_ERROR;
-                }
-                /* get first argument */
-                first = (Operand *)list_first(operands)->data;
-                for (p = list_first(operands)->next; p; p = p->next) {
-                        comparable = (Operand *)p->data;
-                        /* must match types */
-                        if (comparable->type != first->type) {
-                                *result = strdup("#f");
-                                return RETVAL_ATOM;
-                        } else if (first->type == RETVAL_LAMBDA) {
-                                /* compare lambda's addresses */
-                                if (first->value != comparable->value) {
-                                        *result = strdup("#f");
-                                        return RETVAL_ATOM;
-                                }
-                        } else if (is_num((char *)first->value)) {
-                                if (atof((char *)first->value) != atof((char *)comparable->value)) {
-                                        *result = strdup("#f");
-                                        return RETVAL_ATOM;
-                                }
-                        } else {
-                                if (strcmp((char *)first->value, (char *)comparable->value)) {
-                                        *result = strdup("#f");
-                                        return RETVAL_ATOM;
-                                }
-                        }
-                }
-                /* return true when there's no more arguments */
-                *result = strdup("#t");
-                return RETVAL_ATOM;
-        } else if (!strcmp(prim_get(prim), ">") || !strcmp(prim_get(prim), "<") ||
-                               !strcmp(prim_get(prim), ">=") || !strcmp(prim_get(prim), "<=")) {
-                if (list_size(operands) == 0) {
-                        fprintf(stderr, "skm: wrong number of arguments\n");
-                        return RETVAL_ERROR;
-                }
-                /* get first argument */
-                first = (Operand *)list_first(operands)->data;
-                if (first->type != RETVAL_ATOM) {
-                        fprintf(stderr, "skm: wrong type of argument\n");
-                        return RETVAL_ERROR;
-                }
-                /* compare everything to the first argument */
-                for (p = list_first(operands)->next; p; p = p->next) {
-                        comparable = (Operand *)p->data;
-                        /* check type */
-                        if (comparable->type != RETVAL_ATOM) {
-                                fprintf(stderr, "skm: wrong type of argument\n");
-                                return RETVAL_ERROR;
-                        }
-                        if (!strcmp(prim_get(prim), ">"))
-                                boolean = atof((char *)first->value) > atof((char *)comparable->value);
-                        else if (!strcmp(prim_get(prim), ">="))
-                                boolean = atof((char *)first->value) >= atof((char *)comparable->value);
-                        else if (!strcmp(prim_get(prim), "<"))
-                                boolean = atof((char *)first->value) < atof((char *)comparable->value);
-                        else if (!strcmp(prim_get(prim), "<="))
-                                boolean = atof((char *)first->value) <= atof((char *)comparable->value);
-                        if (!boolean) {
-                                *result = strdup("#f");
-                                return RETVAL_ATOM;
-                        }
-                }
-                /* return true when there's no more arguments */
-                *result = strdup("#t");
-                return RETVAL_ATOM;
-        } else if (!strcmp(prim_get(prim), "begin")) {
-                if (list_size(operands) == 0)
-                        return RETVAL_ERROR;
-                last = (Operand *)list_last(operands)->data;
-                if (last->type == RETVAL_ATOM)
-                        *result = strdup((char *)last->value);
-                else if (last->type == RETVAL_LAMBDA)
-                        *result = (char *)last->value;
-                else
-                        return RETVAL_ERROR;
-                return last->type;
-        } else if (!strcmp(prim_get(prim), "display")) {
-                printf("%s", (char *)((Operand *)list_first(operands)->data)->value);
-                *result = strdup("\0");
-                return RETVAL_ATOM;
-        } else if (!strcmp(prim_get(prim), "newline")) {
-                printf("\n");
-                *result = strdup("\0");
-                return RETVAL_ATOM;
+        if (!is_prim(op)) {
+                /* compiled lambdas only run on the vm */
+                fprintf(stderr, "skm: can't apply a compiled procedure without -b\n");
+        } else {
+                if (prof_on)
+                        prof_enter(op);
+                retval = apply_primitive(op, argc, argv, result);
+                if (prof_on)
+                        prof_exit();
         }
-        return RETVAL_ERROR;
+        values_free(argc, argv);
+        return retval;
 }
 
-/* set up a lambda call, return pointer to the prepared environment */
-Env *env_setup_call(Lambda *op, List *operands) {
-        /* bind each operand to a new frame */
-        /* extend this frame to the lambda environment */
+/* Set up a lambda call, return pointer to the prepared environment.
+ * The parameters are bound straight from argv: the new frame takes 
+ * the values over, unless it returns NULL */
+Env *env_setup_call(Lambda *op, int argc, Value *argv) {
         Env *env;
         Frame *f;
-        Bind *bind;
-        Expr *param;
-        /* for iterating through operands list */
-        Node *p;
-        Operand *opand;
+        int i;
 
-        if (op == NULL || operands == NULL)
+        if (op == NULL)
                 return NULL;
         /* check for mis matching number of operands */
-        if (expr_len(op->param) != list_size(operands))
+        if (op->nparams != argc) {
+                fprintf(stderr, "skm: wrong number of arguments\n");
                 return NULL;
-        f = frame_new();
+        }
+        f = frame_new(op->names, op->nslots);
         if (f == NULL)
                 return NULL;
         env = env_extend(op->env, f);
@@ -675,107 +870,352 @@ Env *env_setup_call(Lambda *op, List *operands) {
                 frame_free(f);
                 return NULL;
         }
-        /* go through each parameter and bind an operand to it */
-        p = list_first(operands);
-        for (param = expr_child(op->param); param; param = expr_next(param)) {
-                if (p == NULL)
-                        break;
-                opand = (Operand *)p->data;
-                bind = bind_new(expr_get_word(param), opand->value, opand->type);
-                if (bind == NULL)
-                        break;
-                if (bind_add(env, bind) == NULL)
-                        break;
-                p = p->next;
-        }
-        if (param != NULL) {
-                frame_free(f);
-                return NULL;
-        }
+        /* parameters take the first slots, which are unbound */
+        for (i = 0; i < argc; i++)
+                f->slots[i].value = argv[i];
         return env;
 }
 
 /* Get operator of an expression, which will
  * always be the first atom in the expression */
 Lambda *eval_operator(Env *env, Expr *expr) {
-	void *proc;
+	Value proc;
 	int retval;
 
 	retval = eval(env, expr_child(expr), &proc);
 	if (retval != RETVAL_LAMBDA) {
+		if (retval != RETVAL_ERROR) {
+			fprintf(stderr, "skm: not a procedure\n");
+			value_free(proc);
+		}
 		return NULL;
         }
-	return (Lambda *)proc;
+	return value_get_lambda(proc);
 }
 
-/* Get the operands of an expression */
-List *eval_operands(Env *env, Expr *expr) {
-	List *operands;
-	Operand *op;
-	void *result;
+/* Evaluate the operands of an expression into the argument window
+ * operands, which the caller keeps rooted. Returns -1 on error, 
+ * leaving the window empty */
+int eval_operands(Env *env, Expr *expr, Vector *operands) {
+	Value result;
 	int retval;
 
 	if (expr == NULL)
-		return NULL;
+		return -1;
 	/* make sure it is not an atom or empty list */
 	if (is_atom(expr) || is_emptylist(expr))
-		return NULL;
-	/* allocate a new list for operands */
-	operands = list_new();
-	if (operands == NULL)
-		return NULL;
+		return -1;
 	for (expr = expr_next(expr_child(expr)); expr; expr = expr_next(expr)) {
 		/* evaluate each sub expression recursively */
 		retval = eval(env, expr, &result);
 		if (retval == RETVAL_ERROR) {
-			list_traverse(operands, op_free_helper);
-			list_free(operands);
-			return NULL;
+			operands_clear(operands);
+			return -1;
 		} 
-		op = op_new(result, retval);
-		if (op == NULL) {
-			list_traverse(operands, op_free_helper);
-			list_free(operands);
-			return NULL;
+		if (!vector_push(operands, &result)) {
+			value_free(result);
+			operands_clear(operands);
+			return -1;
 		}
-		list_append(operands, op);
 	}
-	return operands;
+	return 0;
 }
 
-Operand *op_new(void *value, int type) {
-	Operand *op;
+/* free the values in the argument window and empty it */
+void operands_clear(Vector *operands) {
+	values_free(vector_size(operands), vector_data(operands));
+	vector_clear(operands);
+}
 
-	op = malloc(sizeof(Operand));
-	if (op == NULL)
-		return NULL;
-	op->value = value;
-	op->type = type;
-	return op;
+/* free argc values at argv */
+static void values_free(int argc, Value *argv) {
+	int i;
+
+	for (i = 0; i < argc; i++)
+		value_free(argv[i]);
 }
 
-static void op_free_helper(void *data) {
-	op_free((Operand *)data);
+/* find the binding of a variable reference, going straight to
+ * it if the reference has been resolved */
+Bind *lookup(Env *env, Atom *atom) {
+        BindCache *c;
+
+        if (atom->depth >= 0)
+                return frame_slot(env, atom->depth, atom->slot);
+        if (atom->depth == ATOM_GLOBAL) {
+                c = &caches[atom->slot];
+                /* a hit doesn't have to find the global frame */
+                if (c->bind != NULL && c->version == bind_version)
+                        return c->bind;
+                return bind_cached(env_frame(env_global(env)), atom->symbol, 
+                                &c->bind, &c->version);
+        }
+        return env_search(env, atom->symbol);
 }
 
-void op_free(Operand *op) {
-	if (op->type == RETVAL_LAMBDA)
-                lambda_check_remove((Lambda *)op->value);
-	else
-		free(op->value);
-	free(op);
+/************************************************/
+/************   Lexical Addressing   ************/
+/************************************************/
+
+/* Copy the parameters and body of a lambda form and lay out
+ * its frame. The lambda forms nested in it get theirs now too */
+Proto *proto_new(Expr *expr) {
+        Proto *proto;
+        Expr *param, *body;
+
+        param = expr_next(expr_child(expr));
+        body = expr_next(param);
+        if (body == NULL) {
+                fprintf(stderr, "lambda: missing body\n");
+                return NULL;
+        }
+        proto = ds_malloc(sizeof(Proto));
+        if (proto == NULL)
+                return NULL;
+        proto->param = expr_copy(param);
+        proto->body = expr_copy(body);
+        proto->names = NULL;
+        proto->resolved = 0;
+        proto->refs = 1;
+        if (proto->param == NULL || proto->body == NULL)
+                goto fail;
+        proto_disown(proto->body);
+        proto->nslots = expr_scope(proto->param, proto->body, 
+                        &proto->names, &proto->nparams);
+        if (proto->nslots < 0 || proto_nest(proto->body) < 0)
+                goto fail;
+        return proto;
+fail:
+        proto_release(proto);
+        return NULL;
 }
 
-Bind *lookup(Env *env, char *symbol) {
-        return env_search(env, symbol);
+/* Drop a reference to the code of a lambda */
+void proto_release(Proto *proto) {
+        if (proto == NULL || --proto->refs > 0)
+                return;
+        if (proto->resolved)
+                unresolve(proto->body);
+        proto_unnest(proto->body);
+        expr_free(proto->body);
+        expr_free(proto->param);
+        free(proto->names);
+        free(proto);
+}
+
+/* a copy of a body doesn't own the code of the lambda forms
+ * in it, proto_nest makes its own */
+static void proto_disown(Expr *expr) {
+        uint32_t i;
+
+        for (i = 0; i < expr->size; i++) {
+                if (expr[i].kind == EXPR_LIST && expr[i].form == FORM_LAMBDA)
+                        expr[i].proto = NULL;
+        }
+}
+
+/* make the code of the outermost lambda forms in expr */
+static int proto_nest(Expr *expr) {
+        Expr *e;
+
+        if (expr == NULL || is_atom(expr) || is_form(expr, FORM_QUOTE))
+                return 0;
+        if (is_lambda(expr)) {
+                expr->proto = proto_new(expr);
+                return (expr->proto) ? 0 : -1;
+        }
+        for (e = expr_child(expr); e; e = expr_next(e)) {
+                if (proto_nest(e) < 0)
+                        return -1;
+        }
+        return 0;
+}
+
+/* let go of the code made by proto_nest */
+static void proto_unnest(Expr *expr) {
+        Expr *e;
+
+        if (expr == NULL || is_atom(expr) || is_form(expr, FORM_QUOTE))
+                return;
+        if (is_lambda(expr)) {
+                proto_release(expr->proto);
+                return;
+        }
+        for (e = expr_child(expr); e; e = expr_next(e))
+                proto_unnest(e);
+}
+
+/* Lay out the frame of a lambda: parameters first, 
+ * followed by everything its body defines. Return the
+ * number of slots or -1 on error */
+int expr_scope(Expr *params, Expr *body, Symbol ***names, int *nparams) {
+        Expr *param;
+        int n;
+
+        n = expr_len(params);
+        if (n < 0) {
+                fprintf(stderr, "lambda: bad parameter list\n");
+                return -1;
+        }
+        *names = ds_malloc((n + count_defines(body) + 1) * sizeof(Symbol *));
+        if (*names == NULL)
+                return -1;
+        n = 0;
+        for (param = expr_child(params); param; param = expr_next(param)) {
+                if (expr_get_symbol(param) == NULL) {
+                        fprintf(stderr, "lambda: bad parameter list\n");
+                        return -1;
+                }
+                (*names)[n++] = expr_get_symbol(param);
+        }
+        *nparams = n;
+        return collect_defines(body, *names, n);
+}
+
+/* count define forms that belong to this body, a quoted
+ * one is only data */
+static int count_defines(Expr *expr) {
+        Expr *e;
+        int n = 0;
+
+        if (expr == NULL || is_atom(expr) || is_lambda(expr) || is_form(expr, FORM_QUOTE))
+                return 0;
+        if (is_define(expr))
+                n++;
+        for (e = expr_child(expr); e; e = expr_next(e))
+                n += count_defines(e);
+        return n;
+}
+
+/* append the symbols defined by this body to names,
+ * return the new number of names */
+static int collect_defines(Expr *expr, Symbol **names, int n) {
+        Expr *e;
+        Symbol *sym;
+        int i;
+
+        if (expr == NULL || is_atom(expr) || is_lambda(expr) || is_form(expr, FORM_QUOTE))
+                return n;
+        if (is_define(expr)) {
+                sym = expr_get_symbol(expr_next(expr_child(expr)));
+                for (i = 0; i < n && names[i] != sym; i++)
+                        ;
+                if (sym != NULL && i == n)
+                        names[n++] = sym;
+        }
+        for (e = expr_child(expr); e; e = expr_next(e))
+                n = collect_defines(e, names, n);
+        return n;
+}
+
+/* Give every variable reference in the body of a lambda its
+ * lexical address. Nested lambdas are left alone, they are
+ * resolved against the frames that exist when they are created */
+static void resolve(Env *env, Proto *p, Expr *expr) {
+        Expr *e;
+
+        if (expr == NULL)
+                return;
+        if (is_atom(expr)) {
+                /* literals aren't references */
+                if (expr_kind(expr) == EXPR_SYMBOL)
+                        resolve_atom(env, p, expr_get_atom(expr));
+                return;
+        }
+        if (is_lambda(expr) || is_form(expr, FORM_QUOTE))
+                return;
+        for (e = expr_child(expr); e; e = expr_next(e))
+                resolve(env, p, e);
+}
+
+/* depth 0 is the frame of the lambda itself, env is depth 1 */
+static void resolve_atom(Env *env, Proto *p, Atom *atom) {
+        int depth, i;
+
+        for (i = 0; i < p->nslots; i++) {
+                if (p->names[i] == atom->symbol) {
+                        atom->depth = 0;
+                        atom->slot = i;
+                        return;
+                }
+        }
+        for (depth = 1; !env_is_global(env); env = env_parent(env), depth++) {
+                i = frame_find_slot(env_frame(env), atom->symbol);
+                if (i >= 0) {
+                        atom->depth = depth;
+                        atom->slot = i;
+                        return;
+                }
+        }
+        /* without a cache it's searched for by name */
+        i = cache_new();
+        if (i < 0)
+                return;
+        atom->depth = ATOM_GLOBAL;
+        atom->slot = i;
+}
+
+/* give back the caches resolve took for the body */
+static void unresolve(Expr *expr) {
+        Expr *e;
+        Atom *atom;
+
+        if (is_atom(expr)) {
+                atom = expr_get_atom(expr);
+                if (expr_kind(expr) == EXPR_SYMBOL && atom->depth == ATOM_GLOBAL) {
+                        caches[atom->slot].version = cachefree;
+                        cachefree = atom->slot;
+                }
+                return;
+        }
+        if (is_lambda(expr) || is_form(expr, FORM_QUOTE))
+                return;
+        for (e = expr_child(expr); e; e = expr_next(e))
+                unresolve(e);
+}
+
+/* the index of an empty cache, -1 if there's no memory */
+static int cache_new(void) {
+        BindCache *c;
+        int i;
+
+        if (cachefree >= 0) {
+                i = cachefree;
+                cachefree = (int)caches[i].version;
+        } else {
+                if (ncaches == cachesmax) {
+                        cachesmax = (cachesmax) ? cachesmax * 2 : 64;
+                        c = ds_realloc(caches, cachesmax * sizeof(BindCache));
+                        if (c == NULL) {
+                                cachesmax = ncaches;
+                                return -1;
+                        }
+                        caches = c;
+                }
+                i = ncaches++;
+        }
+        caches[i].bind = NULL;
+        caches[i].version = 0;
+        return i;
 }
 
 void cleanup(Env *global) {
-        /* frees all lambdas */
-        env_sweep_lambdas(global);
-        /* frees all frames */
-        env_sweep_frames(global);
+        GcStats *st = gc_stats();
+
+        /* -P profiles until now */
+        while (prof_level() > 0)
+                prof_end();
+        prof_free();
+        /* for bench/, which runs skm with this set */
+        if (getenv("SKM_STATS") != NULL)
+                fprintf(stderr, "stats: %ld frames, %ld lambdas, %d collections\n",
+                                st->frames, st->lambdas, st->collections);
+        /* frees all lambdas and frames */
+        gc_free_all();
+        free(caches);
         /* get rid of global frame/environment */
         frame_free(env_frame(global));
 	tree_free(global);
+        /* flush and close every port */
+        port_free_all();
 }
@@ -0,0 +1,80 @@
+/* skm - scheme interpreter
+ * author: Eugene Ma (edma2) */
+#ifndef EVAL_H
+#define EVAL_H
+#include "skm.h"
+
+/* if set, (load) reports like -p does */
+extern int load_report;
+
+/* the special forms, the symbol of each keyword knows its own */
+enum {
+	FORM_NONE,
+	FORM_DEFINE,
+	FORM_LAMBDA,
+	FORM_IF,
+	FORM_COND,
+	FORM_LOAD,
+	FORM_BEGIN,
+	FORM_TIME,
+	FORM_PROFILE,
+	FORM_QUOTE,
+	/* a call opt.c worked out, see is_folded */
+	FORM_FOLDED
+};
+
+/* the code of a lambda form, shared by every closure made from it */
+struct Proto {
+	Expr *body;
+	Expr *param;
+	/* frame layout: parameters, then internal defines */
+	Symbol **names;
+	int nparams;
+	int nslots;
+	/* set once its variables have lexical addresses */
+	int resolved;
+	int refs;
+};
+
+int eval(Env *env, Expr *expr, Value *result);
+int apply(Lambda *op, int argc, Value *argv, Value *result);
+int eval_lambda(Env *env, Expr *expr, Value *result);
+int eval_define(Env *env, Expr *expr, Value *result);
+int eval_if(Env *env, Expr *expr, Expr **branch);
+int eval_cond(Env *env, Expr *expr, Expr **branch);
+int eval_begin(Env *env, Expr *expr, Expr **last);
+int eval_load(Env *env, Expr *expr, Value *result);
+int eval_time(Env *env, Expr *expr, Value *result);
+int eval_profile(Env *env, Expr *expr, Value *result);
+int quote_value(Expr *datum, Value *result);
+int load(Env *env, char *filename, int (*evaluate)(Env *, Expr *, Value *), 
+		int report, Value *result);
+int load_file(Env *env, char *filename, int (*evaluate)(Env *, Expr *, Value *), int report);
+int load_buffer(Env *env, char *buf, size_t n, int (*evaluate)(Env *, Expr *, Value *), int *forms);
+int is_atom(Expr *expr);
+int is_list(Expr *expr);
+int is_emptylist(Expr *expr);
+int is_define(Expr *expr);
+int is_lambda(Expr *expr);
+int is_load(Expr *expr);
+int is_display(Expr *expr);
+int is_begin(Expr *expr);
+int is_time(Expr *expr);
+int is_profile(Expr *expr);
+int is_quote(Expr *expr);
+int is_folded(Env *env, Expr *expr);
+int is_if(Expr *expr);
+int is_cond(Expr *expr);
+int is_else(Expr *expr);
+int is_prim(Lambda *b);
+
+Proto *proto_new(Expr *expr);
+void proto_release(Proto *proto);
+int expr_scope(Expr *param, Expr *body, Symbol ***names, int *nparams);
+Env *env_setup_call(Lambda *op, int argc, Value *argv);
+Bind *lookup(Env *env, Atom *atom);
+Lambda *eval_operator(Env *env, Expr *expr);
+void cleanup(Env *env);
+int eval_operands(Env *env, Expr *expr, Vector *operands);
+void operands_clear(Vector *operands);
+#endif
@@ -0,0 +1,280 @@
+/* skm - scheme interpreter
+ * author: Eugene Ma (edma2) */
+#include <time.h>
+#include "eval.h"
+#include "vm.h"
+#include "gc.h"
+
+/* don't bother collecting a heap smaller than this */
+#ifndef GC_MIN
+#define GC_MIN 		10000
+#endif
+
+static void gc_scan(Env *env);
+static void gc_scan_bind(void *data);
+static int gc_push(Env *env);
+static long gc_sweep_lambdas(void);
+static long gc_sweep_env(Env *env);
+static long gc_free_env(Env *env);
+static double gc_now(void);
+
+static Env *gc_global = NULL;
+/* every lambda there is, newest first */
+static Lambda *lambdas = NULL;
+Root *gc_roots = NULL;
+int gc_nroots = 0, gc_rootsmax = 0;
+/* frames marked but not scanned yet */
+static Env **gray = NULL;
+static int ngray = 0, graymax = 0;
+static GcStats stats;
+
+/************************************************/
+/****************   Interface   *****************/
+/************************************************/
+
+/* Collect garbage that isn't reachable from global */
+void gc_init(Env *global) {
+	gc_global = global;
+	memset(&stats, 0, sizeof(stats));
+}
+
+/* Called before a lambda or frame is allocated, collects
+ * once the heap has about doubled since the last time */
+void gc_poll(void) {
+	if (++stats.allocated < GC_MIN || stats.allocated < stats.live)
+		return;
+	gc_collect();
+}
+
+/* start managing a new lambda */
+void gc_track(Lambda *b) {
+	b->mark = 0;
+	b->next = lambdas;
+	lambdas = b;
+}
+
+/* an object was freed without the collector */
+void gc_forget(void) {
+	if (stats.allocated > 0)
+		stats.allocated--;
+}
+
+/* make room for more roots */
+void gc_root_grow(void) {
+	Root *r;
+
+	gc_rootsmax = (gc_rootsmax) ? gc_rootsmax * 2 : 64;
+	r = ds_realloc(gc_roots, gc_rootsmax * sizeof(Root));
+	if (r == NULL) {
+		fprintf(stderr, "skm: out of memory\n");
+		exit(1);
+	}
+	gc_roots = r;
+}
+
+GcStats *gc_stats(void) {
+	return &stats;
+}
+
+/************************************************/
+/*****************   Marking   ******************/
+/************************************************/
+
+/* Mark everything reachable from the roots, free the rest.
+ * Returns the number of objects freed */
+long gc_collect(void) {
+	Root *r;
+	Vector *v;
+	double start = gc_now();
+	long freed;
+	int i, j;
+
+	if (gc_global == NULL)
+		return 0;
+	gc_mark_env(gc_global);
+	for (i = 0; i < gc_nroots; i++) {
+		r = &gc_roots[i];
+		if (r->kind == ROOT_VALUE) {
+			gc_mark_value(*(Value *)r->addr);
+		} else if (r->kind == ROOT_ENV) {
+			gc_mark_env(*(Env **)r->addr);
+		} else if (r->kind == ROOT_LAMBDA) {
+			if (*(Lambda **)r->addr != NULL)
+				gc_mark_value(value_ptr(TAG_LAMBDA, *(Lambda **)r->addr));
+		} else {
+			v = (Vector *)r->addr;
+			for (j = 0; j < vector_size(v); j++)
+				gc_mark_value(((Value *)vector_data(v))[j]);
+		}
+	}
+	vm_mark_roots();
+	/* a frame's values can lead to more frames */
+	while (ngray > 0)
+		gc_scan(gray[--ngray]);
+	freed = gc_sweep_lambdas();
+	freed += gc_sweep_env(gc_global);
+	freed += pair_sweep();
+	freed += port_sweep();
+	env_frame(gc_global)->mark = 0;
+	stats.collections++;
+	stats.freed += freed;
+	stats.live = stats.live + stats.allocated - freed;
+	stats.allocated = 0;
+	stats.last_pause = gc_now() - start;
+	stats.total_pause += stats.last_pause;
+	if (stats.last_pause > stats.max_pause)
+		stats.max_pause = stats.last_pause;
+	return freed;
+}
+
+void gc_mark_value(Value v) {
+	Lambda *b;
+	Pair *p;
+
+	/* down the cdrs in a loop, a long list would
+	 * recurse too deep otherwise */
+	while (value_tag(v) == TAG_PAIR) {
+		p = value_get_pair(v);
+		if (!pair_mark(p))
+			return;
+		gc_mark_value(p->car);
+		v = p->cdr;
+	}
+	if (value_tag(v) == TAG_PORT)
+		value_get_port(v)->mark = 1;
+	if (value_tag(v) != TAG_LAMBDA)
+		return;
+	b = value_get_lambda(v);
+	if (b->mark)
+		return;
+	b->mark = 1;
+	gc_mark_env(b->env);
+}
+
+/* mark a frame along with the frames it extends, their
+ * bindings are scanned later so marking doesn't recurse */
+void gc_mark_env(Env *env) {
+	for (; env != NULL; env = env_parent(env)) {
+		if (env_frame(env)->mark)
+			return;
+		env_frame(env)->mark = 1;
+		if (gc_push(env) < 0) {
+			fprintf(stderr, "skm: out of memory\n");
+			exit(1);
+		}
+	}
+}
+
+static void gc_scan(Env *env) {
+	Frame *f = env_frame(env);
+	int i;
+
+	if (f->index != NULL)
+		hash_traverse(f->index, gc_scan_bind);
+	for (i = 0; i < f->size; i++)
+		gc_mark_value(f->slots[i].value);
+}
+
+static void gc_scan_bind(void *data) {
+	gc_mark_value(((Bind *)data)->value);
+}
+
+static int gc_push(Env *env) {
+	Env **g;
+
+	if (ngray == graymax) {
+		graymax = (graymax) ? graymax * 2 : 64;
+		g = ds_realloc(gray, graymax * sizeof(Env *));
+		if (g == NULL)
+			return -1;
+		gray = g;
+	}
+	gray[ngray++] = env;
+	return 0;
+}
+
+/************************************************/
+/*****************   Sweeping   *****************/
+/************************************************/
+
+static long gc_sweep_lambdas(void) {
+	Lambda **link = &lambdas, *b;
+	long freed = 0;
+
+	while ((b = *link) != NULL) {
+		if (b->mark) {
+			b->mark = 0;
+			link = &b->next;
+		} else {
+			*link = b->next;
+			lambda_free(b);
+			freed++;
+		}
+	}
+	return freed;
+}
+
+/* env is live, unlink and free the children that aren't.
+ * A live frame's parent is always marked, so everything
+ * below a dead one is dead too */
+static long gc_sweep_env(Env *env) {
+	Env **link = &env->child, *c;
+	long freed = 0;
+
+	while ((c = *link) != NULL) {
+		if (env_frame(c)->mark) {
+			env_frame(c)->mark = 0;
+			freed += gc_sweep_env(c);
+			link = &c->next;
+		} else {
+			*link = c->next;
+			if (c->next != NULL)
+				c->next->prev = c->prev;
+			freed += gc_free_env(c);
+		}
+	}
+	return freed;
+}
+
+/* free a frame and everything that extends it */
+static long gc_free_env(Env *env) {
+	Env *c, *next;
+	long freed = 1;
+
+	for (c = env->child; c; c = next) {
+		next = c->next;
+		freed += gc_free_env(c);
+	}
+	frame_free(env_frame(env));
+	free(env);
+	return freed;
+}
+
+/* free every lambda, frame and pair, at exit */
+void gc_free_all(void) {
+	Lambda *b, *bnext;
+	Env *c, *next;
+
+	for (b = lambdas; b; b = bnext) {
+		bnext = b->next;
+		lambda_free(b);
+	}
+	lambdas = NULL;
+	if (gc_global != NULL) {
+		for (c = gc_global->child; c; c = next) {
+			next = c->next;
+			gc_free_env(c);
+		}
+		gc_global->child = NULL;
+	}
+	pair_free_all();
+	free(gc_roots);
+	free(gray);
+}
+
+static double gc_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
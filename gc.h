@@ -0,0 +1,65 @@
+/* skm - scheme interpreter
+ * author: Eugene Ma (edma2) */
+#ifndef GC_H
+#define GC_H
+#include "skm.h"
+
+/* what the address of a root points to */
+enum {
+	ROOT_VALUE, 	/* Value */
+	ROOT_ENV, 	/* Env * */
+	ROOT_LAMBDA, 	/* Lambda *, may be NULL */
+	ROOT_OPERANDS 	/* Vector of Value */
+};
+
+typedef struct {
+	int kind;
+	void *addr;
+} Root;
+
+typedef struct {
+	int collections;
+	/* objects allocated since the last collection */
+	long allocated;
+	/* objects that survived the last one */
+	long live;
+	long freed;
+	/* frames and lambdas made since the start */
+	long frames;
+	long lambdas;
+	/* pauses in seconds */
+	double last_pause;
+	double max_pause;
+	double total_pause;
+} GcStats;
+
+void gc_init(Env *global);
+void gc_poll(void);
+void gc_track(Lambda *b);
+void gc_forget(void);
+long gc_collect(void);
+void gc_root_grow(void);
+void gc_mark_value(Value v);
+void gc_mark_env(Env *env);
+void gc_free_all(void);
+GcStats *gc_stats(void);
+
+/* the addresses of the locals that hold objects in use */
+extern Root *gc_roots;
+extern int gc_nroots, gc_rootsmax;
+
+/* Protect the object whose address is addr while the local
+ * lives. Returns the height to give back to gc_unroot */
+static inline int gc_root(int kind, void *addr) {
+	if (gc_nroots == gc_rootsmax)
+		gc_root_grow();
+	gc_roots[gc_nroots].kind = kind;
+	gc_roots[gc_nroots].addr = addr;
+	return gc_nroots++;
+}
+
+/* drop every root pushed since height */
+static inline void gc_unroot(int height) {
+	gc_nroots = height;
+}
+#endif
@@ -1,4 +1,7 @@
 (begin 
-(define cons (lambda (car cdr) (lambda (c) (if (= c 'car) car (if (= c 'cdr) cdr '#f)))))
-(define car (lambda (pair) (pair 'car))) 
-(define cdr (lambda (pair) (pair 'cdr))))
+(define reverse-onto (lambda (l acc) (if (null? l) acc (reverse-onto (cdr l) (cons (car l) acc)))))
+(define reverse (lambda (l) (reverse-onto l '())))
+(define append (lambda (a b) (reverse-onto (reverse a) b)))
+(define length-from (lambda (l n) (if (null? l) n (length-from (cdr l) (+ n 1)))))
+(define length (lambda (l) (length-from l 0)))
+(define map (lambda (f l) (if (null? l) '() (cons (f (car l)) (map f (cdr l)))))))
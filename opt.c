@@ -0,0 +1,323 @@
+/* skm - scheme interpreter
+ * author: Eugene Ma (edma2) */
+#include "prim.h"
+#include "opt.h"
+
+/* most operands of a call that gets folded */
+#define OPT_ARGS 	16
+
+/* what's known about the form being optimized */
+typedef struct {
+	Env *env;
+	/* Symbol * parameters of the lambdas we're in */
+	Vector bound;
+	/* Symbol * defined anywhere in the form */
+	Vector defined;
+} Opt;
+
+static int opt_collect(Opt *o, Expr *expr);
+static int opt_expr(Opt *o, Expr *expr);
+static int opt_lambda(Opt *o, Expr *expr);
+static void opt_call(Opt *o, Expr *expr);
+static int opt_number(Expr *expr, Value *v);
+static void dump_value(Value v);
+static int opt_clause(Opt *o, Expr *clause);
+static void opt_if(Expr *expr);
+static void opt_cond(Expr *expr);
+static Primitive *opt_primitive(Opt *o, Symbol *sym);
+static int opt_has(Vector *v, Symbol *sym);
+static int is_constant(Expr *expr);
+static int is_false(Expr *expr);
+
+int opt_dump = 0;
+
+/************************************************/
+/****************   Interface   *****************/
+/************************************************/
+
+/* Simplify a form before it runs in env, which is when the bodies
+ * of the lambdas and defines in it are made. Calls to pure primitives
+ * on numbers are worked out now, and an if or cond whose predicates
+ * are literals becomes the branch it would take. A call isn't folded
+ * if its operator is a parameter in scope or defined anywhere in the
+ * form, since it might not be the primitive then. A folded call keeps
+ * its operands, and is evaluated as a call again while its operator
+ * isn't bound to the primitive it was folded with */
+void optimize(Env *env, Expr *expr) {
+	Opt o;
+
+	o.env = env;
+	vector_init(&o.bound, sizeof(Symbol *));
+	vector_init(&o.defined, sizeof(Symbol *));
+	/* it's only worth doing if it's sure to be right */
+	if (opt_collect(&o, expr) == 0) {
+		opt_expr(&o, expr);
+		/* so nothing copies or walks the branches cut off */
+		expr_compact(expr);
+	}
+	vector_release(&o.bound);
+	vector_release(&o.defined);
+	if (opt_dump) {
+		expr_dump(expr);
+		fputc('\n', stderr);
+	}
+}
+
+/* print an expression to stderr the way it could be read back */
+void expr_dump(Expr *expr) {
+	Expr *e;
+	char *name;
+
+	if (expr == NULL)
+		return;
+	switch (expr_kind(expr)) {
+	case EXPR_LIST:
+		/* what it will be evaluated as */
+		if (expr_form(expr) == FORM_FOLDED) {
+			dump_value(expr->fold.value);
+			break;
+		}
+		fputc('(', stderr);
+		for (e = expr_child(expr); e; e = expr_next(e)) {
+			expr_dump(e);
+			if (expr_next(e))
+				fputc(' ', stderr);
+		}
+		fputc(')', stderr);
+		break;
+	case EXPR_NUM:
+	case EXPR_BOOL:
+		dump_value(expr_get_value(expr));
+		break;
+	case EXPR_STRING:
+		/* the reader kept the opening quote only */
+		name = expr_get_word(expr);
+		fprintf(stderr, (*name == '\"') ? "%s\"" : "%s", name);
+		break;
+	default:
+		fputs(expr_get_word(expr), stderr);
+	}
+}
+
+/* a number or boolean the way it's written */
+static void dump_value(Value v) {
+	if (value_tag(v) == TAG_BOOL)
+		fputs((v == VALUE_TRUE) ? "#t" : "#f", stderr);
+	else if (value_tag(v) == TAG_FIXNUM)
+		fprintf(stderr, "%d", value_get_fixnum(v));
+	else
+		fprintf(stderr, "%.15g", value_get_num(v));
+}
+
+/************************************************/
+/****************   Folding   *******************/
+/************************************************/
+
+/* note every symbol that a define in expr binds */
+static int opt_collect(Opt *o, Expr *expr) {
+	Symbol *sym;
+	Expr *e;
+
+	if (expr_is_word(expr) || expr_form(expr) == FORM_QUOTE)
+		return 0;
+	if (expr_form(expr) == FORM_DEFINE && expr_len(expr) == 3) {
+		sym = expr_get_symbol(expr_next(expr_child(expr)));
+		if (sym != NULL && !vector_push(&o->defined, &sym))
+			return -1;
+	}
+	for (e = expr_child(expr); e; e = expr_next(e)) {
+		if (opt_collect(o, e) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* simplify the insides of expr first, then expr itself. The
+ * node expr is at stays where it is, whatever it turns into.
+ * Quoted data is left as it was read */
+static int opt_expr(Opt *o, Expr *expr) {
+	Expr *e;
+
+	if (expr_is_word(expr) || expr_form(expr) == FORM_QUOTE)
+		return 0;
+	if (expr_form(expr) == FORM_LAMBDA && expr_len(expr) == 3)
+		return opt_lambda(o, expr);
+	for (e = expr_child(expr); e; e = expr_next(e)) {
+		/* the clauses of a cond aren't calls, only what's in them */
+		if (expr_form(expr) == FORM_COND && !expr_is_word(e)) {
+			if (opt_clause(o, e) < 0)
+				return -1;
+		} else if (opt_expr(o, e) < 0) {
+			return -1;
+		}
+	}
+	if (expr_form(expr) == FORM_IF)
+		opt_if(expr);
+	else if (expr_form(expr) == FORM_COND)
+		opt_cond(expr);
+	else if (expr_form(expr) == FORM_NONE)
+		opt_call(o, expr);
+	return 0;
+}
+
+static int opt_clause(Opt *o, Expr *clause) {
+	Expr *e;
+
+	for (e = expr_child(clause); e; e = expr_next(e)) {
+		if (opt_expr(o, e) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* the parameters of a lambda hide anything by that name
+ * while we're in its body */
+static int opt_lambda(Opt *o, Expr *expr) {
+	Expr *param = expr_next(expr_child(expr));
+	Symbol *sym;
+	Expr *e;
+	int height = vector_size(&o->bound);
+	int retval = 0;
+
+	for (e = expr_child(param); e; e = expr_next(e)) {
+		sym = expr_get_symbol(e);
+		if (sym != NULL && !vector_push(&o->bound, &sym))
+			retval = -1;
+	}
+	if (retval == 0)
+		retval = opt_expr(o, expr_next(param));
+	while (vector_size(&o->bound) > height)
+		vector_pop(&o->bound);
+	return retval;
+}
+
+/* A pure primitive applied to numbers is worked out. The call
+ * stays as it is under the result, in case it's needed again */
+static void opt_call(Opt *o, Expr *expr) {
+	Value argv[OPT_ARGS], v;
+	Primitive *prim;
+	Expr *op = expr_child(expr), *e;
+	int argc = 0;
+
+	if (op == NULL || expr_kind(op) != EXPR_SYMBOL)
+		return;
+	for (e = expr_next(op); e; e = expr_next(e)) {
+		if (argc == OPT_ARGS || opt_number(e, &argv[argc]) < 0)
+			return;
+		argc++;
+	}
+	prim = opt_primitive(o, expr_get_symbol(op));
+	if (prim == NULL)
+		return;
+	/* leave mistakes to be reported when it runs */
+	if (argc < prim->min || (prim->max != ARGS_ANY && argc > prim->max))
+		return;
+	if (prim->fn(argc, argv, &v) == RETVAL_ERROR)
+		return;
+	if (!value_is_num(v) && value_tag(v) != TAG_BOOL)
+		return;
+	expr->form = FORM_FOLDED;
+	expr->fold.value = v;
+	expr->fold.prim = prim;
+}
+
+/* the number a literal or a folded call stands for */
+static int opt_number(Expr *expr, Value *v) {
+	if (expr_kind(expr) == EXPR_NUM) {
+		*v = expr_get_value(expr);
+		return 0;
+	}
+	if (expr_form(expr) == FORM_FOLDED && value_is_num(expr->fold.value)) {
+		*v = expr->fold.value;
+		return 0;
+	}
+	return -1;
+}
+
+/* an if whose predicate is a literal is the branch it takes */
+static void opt_if(Expr *expr) {
+	Expr *predicate, *consequent, *alternative;
+
+	if (expr_len(expr) != 3 && expr_len(expr) != 4)
+		return;
+	predicate = expr_next(expr_child(expr));
+	consequent = expr_next(predicate);
+	alternative = expr_next(consequent);
+	if (!is_constant(predicate))
+		return;
+	if (!is_false(predicate))
+		expr_replace(expr, consequent);
+	/* with no false branch there's nothing to put there */
+	else if (alternative != NULL)
+		expr_replace(expr, alternative);
+}
+
+/* drop the clauses of a cond that can't be taken, and if the
+ * first one left is always taken the cond is its expression */
+static void opt_cond(Expr *expr) {
+	Expr *clause, *prev, *next, *predicate;
+
+	/* leave mistakes to be reported when it runs */
+	for (clause = expr_next(expr_child(expr)); clause; clause = expr_next(clause)) {
+		if (expr_len(clause) != 2)
+			return;
+		if (is_else(expr_child(clause)) && expr_next(clause) != NULL)
+			return;
+	}
+	prev = expr_child(expr);
+	for (clause = expr_next(prev); clause; clause = next) {
+		next = expr_next(clause);
+		/* keep the last one so it's still a cond */
+		if (is_false(expr_child(clause)) && expr_len(expr) > 2)
+			expr_remove_next(expr, prev);
+		else
+			prev = clause;
+	}
+	clause = expr_next(expr_child(expr));
+	if (clause == NULL)
+		return;
+	predicate = expr_child(clause);
+	if (is_else(predicate) || (is_constant(predicate) && !is_false(predicate)))
+		expr_replace(expr, expr_next(predicate));
+}
+
+/* the primitive sym stands for, NULL if it might not be one
+ * by the time the form runs or if it isn't pure */
+static Primitive *opt_primitive(Opt *o, Symbol *sym) {
+	Bind *bind;
+	Lambda *b;
+
+	if (opt_has(&o->bound, sym) || opt_has(&o->defined, sym))
+		return NULL;
+	bind = env_search(o->env, sym);
+	if (bind == NULL || value_tag(bind->value) != TAG_LAMBDA)
+		return NULL;
+	b = value_get_lambda(bind->value);
+	if (!is_prim(b) || !b->prim->pure)
+		return NULL;
+	return b->prim;
+}
+
+static int opt_has(Vector *v, Symbol *sym) {
+	Symbol **syms = vector_data(v);
+	int i;
+
+	for (i = 0; i < vector_size(v); i++) {
+		if (syms[i] == sym)
+			return 1;
+	}
+	return 0;
+}
+
+/* A literal, which evaluates to itself. A folded call isn't
+ * one, its value can still change */
+static int is_constant(Expr *expr) {
+	int kind = expr_kind(expr);
+
+	return (kind == EXPR_NUM || kind == EXPR_BOOL || kind == EXPR_STRING);
+}
+
+/* the only thing that isn't true */
+static int is_false(Expr *expr) {
+	return (expr_kind(expr) == EXPR_BOOL && expr_get_value(expr) == VALUE_FALSE);
+}
@@ -0,0 +1,12 @@
+/* skm - scheme interpreter
+ * author: Eugene Ma (edma2) */
+#ifndef OPT_H
+#define OPT_H
+#include "skm.h"
+
+/* if set, every form is printed to stderr once it's optimized */
+extern int opt_dump;
+
+void optimize(Env *env, Expr *expr);
+void expr_dump(Expr *expr);
+#endif
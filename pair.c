@@ -0,0 +1,164 @@
+/* skm - scheme interpreter
+ * author: Eugene Ma (edma2) */
+#include "gc.h"
+
+/* Pairs come 16 bytes apiece out of pages of this size, which
+ * start on a multiple of it so a pair can find its page. The
+ * start of a page holds the bits the collector needs for it */
+#define PAIR_PAGE 	65536
+#define PAIR_CELLS 	(PAIR_PAGE / sizeof(Pair))
+#define PAIR_WORDS 	(PAIR_CELLS / 64)
+
+typedef struct PairPage PairPage;
+struct PairPage {
+	PairPage *next;
+	/* a bit for every cell, set if it's reachable */
+	uint64_t mark[PAIR_WORDS];
+	/* and if it's holding a pair */
+	uint64_t used[PAIR_WORDS];
+};
+
+/* the first cell that isn't under the header */
+#define PAIR_FIRST 	((sizeof(PairPage) + sizeof(Pair) - 1) / sizeof(Pair))
+
+static PairPage *pair_page(Pair *p);
+static int pair_grow(void);
+static void pair_release(PairPage *page, int i);
+
+static PairPage *pages = NULL;
+/* cells that aren't holding a pair, linked through their car */
+static Pair *freelist = NULL;
+
+/************************************************/
+/****************   Interface   *****************/
+/************************************************/
+
+/* A pair of car and cdr, which it owns from now on.
+ * Returns NULL if there's no memory left */
+Pair *pair_new(Value car, Value cdr) {
+	PairPage *page;
+	Pair *p;
+	int i;
+
+	gc_poll();
+	if (freelist == NULL && pair_grow() < 0)
+		return NULL;
+	p = freelist;
+	freelist = (Pair *)value_get_ptr(p->car);
+	page = pair_page(p);
+	i = p - (Pair *)page;
+	page->used[i / 64] |= 1ULL << (i % 64);
+	p->car = car;
+	p->cdr = cdr;
+	return p;
+}
+
+/* returns 1 if p wasn't marked before */
+int pair_mark(Pair *p) {
+	PairPage *page = pair_page(p);
+	int i = p - (Pair *)page;
+	uint64_t bit = 1ULL << (i % 64);
+
+	if (page->mark[i / 64] & bit)
+		return 0;
+	page->mark[i / 64] |= bit;
+	return 1;
+}
+
+/* Free the pairs that weren't marked and unmark the rest,
+ * pages left empty go back to the system. Returns the
+ * number of pairs freed */
+long pair_sweep(void) {
+	PairPage **link = &pages, *page;
+	uint64_t dead, live;
+	Pair *p;
+	long freed = 0;
+	int i, w;
+
+	freelist = NULL;
+	while ((page = *link) != NULL) {
+		live = 0;
+		for (w = 0; w < PAIR_WORDS; w++) {
+			dead = page->used[w] & ~page->mark[w];
+			for (; dead; dead &= dead - 1) {
+				p = (Pair *)page + w * 64 + __builtin_ctzll(dead);
+				value_free(p->car);
+				value_free(p->cdr);
+				freed++;
+			}
+			page->used[w] = page->mark[w];
+			page->mark[w] = 0;
+			live |= page->used[w];
+		}
+		if (live == 0) {
+			*link = page->next;
+			free(page);
+			continue;
+		}
+		/* the free list is made again from what's left */
+		for (i = PAIR_CELLS - 1; i >= (int)PAIR_FIRST; i--) {
+			if (!(page->used[i / 64] & (1ULL << (i % 64))))
+				pair_release(page, i);
+		}
+		link = &page->next;
+	}
+	return freed;
+}
+
+/* free every pair, at exit */
+void pair_free_all(void) {
+	PairPage *page, *next;
+	uint64_t used;
+	int w;
+
+	for (page = pages; page; page = next) {
+		next = page->next;
+		for (w = 0; w < PAIR_WORDS; w++) {
+			for (used = page->used[w]; used; used &= used - 1)
+				pair_release(page, w * 64 + __builtin_ctzll(used));
+		}
+		free(page);
+	}
+	pages = NULL;
+	freelist = NULL;
+}
+
+/************************************************/
+/*****************   Pages   ********************/
+/************************************************/
+
+static PairPage *pair_page(Pair *p) {
+	return (PairPage *)((uintptr_t)p & ~(uintptr_t)(PAIR_PAGE - 1));
+}
+
+/* add a page of free cells */
+static int pair_grow(void) {
+	PairPage *page = aligned_alloc(PAIR_PAGE, PAIR_PAGE);
+	int i;
+
+	if (page == NULL)
+		return -1;
+	ds_allocs++;
+	ds_alloc_bytes += PAIR_PAGE;
+	memset(page, 0, sizeof(PairPage));
+	page->next = pages;
+	pages = page;
+	for (i = PAIR_CELLS - 1; i >= (int)PAIR_FIRST; i--)
+		pair_release(page, i);
+	return 0;
+}
+
+/* Cell i of page goes on the free list, along with whatever
+ * its pair held. A cell that's already free holds nothing,
+ * so the values are only freed if it's in use */
+static void pair_release(PairPage *page, int i) {
+	Pair *p = (Pair *)page + i;
+
+	if (page->used[i / 64] & (1ULL << (i % 64))) {
+		value_free(p->car);
+		value_free(p->cdr);
+		page->used[i / 64] &= ~(1ULL << (i % 64));
+	}
+	p->car = value_ptr(TAG_PAIR, freelist);
+	freelist = p;
+}
@@ -1,250 +1,885 @@
 /* skm - scheme interpreter
  * author: Eugene Ma (edma2) */
-#include "parser.h"
-
-#define STATE_BEGIN 		0
-#define STATE_OPEN_PAREN 	1
-#define STATE_CLOSE_PAREN 	2
-#define STATE_PROC 		3
-#define STATE_ARG 		4
-#define STATE_END 		5
-#define STATE_ERROR 		6
-#define STATE_QUOTE             7
-#define MAX_WORD 		200
-#define TYPE_PROC 		0
-#define TYPE_ARG 		1
-
-static Tree *up(Tree *t);
-static Tree *down(Tree *t);
-static int expr_insert_word(Tree *t, void *data, int type);
-static void expr_copy_helper(Expr *copy);
-static void expr_free_helper(Expr *e);
-
-int is_whitespace(char c) {
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include "skm.h"
+
+/* x86 always has sse2 in 64 bit mode */
+#if defined(__x86_64__) && defined(__GNUC__)
+#define LEX_SSE2
+#include <emmintrin.h>
+#endif
+
+#define STATE_BEGIN 		0 	/* between expressions */
+#define STATE_LIST 		1 	/* in a list, between words */
+#define STATE_WORD 		2
+#define STATE_QUOTE             3
+#define MAX_WORD 		200 	/* to start with, longer words grow it */
+#define READ_CHUNK 		65536
+#define EXPR_HINT 		64 	/* nodes, to start with */
+#define SYMTAB_MIN 		64
+/* what a string literal takes after the nodes of its expression */
+#define STRING_SIZE(n) 		((sizeof(Symbol) + (n) + 8) & ~(size_t)7)
+
+/* a list that's still being read */
+typedef struct {
+	uint32_t list;
+	uint32_t last; 		/* its last child so far, 0 if none */
+	uint32_t quote; 	/* a (quote that ends with the list in it */
+} Open;
+
+static void reader_start(Reader *r);
+static Expr *reader_node(Reader *r, int kind);
+static int reader_open(Reader *r);
+static int reader_close(Reader *r);
+static int reader_quote(Reader *r);
+static Expr *reader_take(Reader *r);
+static int reader_append(Reader *r, char *s, size_t n);
+static int reader_word(Reader *r);
+static int reader_span(Reader *r, char *s, size_t n);
+static int reader_string(Reader *r, char *s, size_t n);
+static Symbol *string_put(char *to, char *name, size_t n);
+static int reader_error(Reader *r, char *msg);
+static int is_num(char *s, size_t n);
+static int parse_num(char *s, size_t n, uint64_t *v);
+static uint32_t expr_pack(Expr *expr, Expr *to);
+static int is_whitespace(char c);
+static void lex_init(void);
+static size_t lex_delim_scalar(char *s, size_t n);
+static size_t lex_space_scalar(char *s, size_t n);
+#ifdef LEX_SSE2
+static size_t lex_delim_sse2(char *s, size_t n);
+static size_t lex_space_sse2(char *s, size_t n);
+#endif
+static unsigned int symbol_hash(char *name, size_t n);
+static int symtab_grow(void);
+
+/* chained hash table of every interned symbol */
+static Symbol **symtab = NULL;
+static unsigned int symtab_size = 0;
+static unsigned int symtab_count = 0;
+
+/* where the next whitespace, paren or quote in the n bytes at s
+ * is, and where the next thing that isn't whitespace is. Both 
+ * return n if there isn't one */
+#ifdef LEX_SSE2
+#define lex_delim 	lex_delim_sse2
+#define lex_space 	lex_space_sse2
+#else
+#define lex_delim 	lex_delim_scalar
+#define lex_space 	lex_space_scalar
+#endif
+/* LEX_SPACE and LEX_DELIM bits of every character */
+static unsigned char lex_class[256];
+static int lex_ready = 0;
+#define LEX_SPACE 	1
+#define LEX_DELIM 	2
+/* bytes looked at one by one before the vector loop */
+#define LEX_SHORT 	8
+
+static int is_whitespace(char c) {
         return (c == ' ' || c == '\n' || c == '\t' || c == '\r');
 }
 
-/* copy elements of exp buffer into a tree */
-Expr *parse(char *exp) {
-	Tree *root;
-	int state = STATE_BEGIN;	
-	int layer = 0;
-	char *ptr = exp;
-	char buf[MAX_WORD];
-	int i = 0; 		
-
-	/* check if malloc succeeded */
-	if ((root = tree_new(NULL)) == NULL)
+/************************************************/
+/*****************   Lexing   *******************/
+/************************************************/
+
+static void lex_init(void) {
+	int c;
+
+	for (c = 0; c < 256; c++) {
+		lex_class[c] = 0;
+		if (is_whitespace(c))
+			lex_class[c] = LEX_SPACE | LEX_DELIM;
+		else if (c == '(' || c == ')' || c == '\"')
+			lex_class[c] = LEX_DELIM;
+	}
+	lex_ready = 1;
+}
+
+/* the name of the scanner in use */
+char *lex_name(void) {
+#ifdef LEX_SSE2
+	return "sse2";
+#else
+	return "scalar";
+#endif
+}
+
+static size_t lex_delim_scalar(char *s, size_t n) {
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		if (lex_class[(unsigned char)s[i]] & LEX_DELIM)
+			break;
+	}
+	return i;
+}
+
+static size_t lex_space_scalar(char *s, size_t n) {
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		if (!(lex_class[(unsigned char)s[i]] & LEX_SPACE))
+			break;
+	}
+	return i;
+}
+
+#ifdef LEX_SSE2
+/* Compare a block at a time against every character of the
+ * class, the first set bit of the mask is the one we want. 
+ * Whatever doesn't fill a block is left to the scalar loop */
+static inline __m128i space_sse2(__m128i v) {
+	return _mm_or_si128(
+		_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+			_mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))),
+		_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\t')),
+			_mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+}
+
+static size_t lex_delim_sse2(char *s, size_t n) {
+	__m128i v, m;
+	unsigned int bits;
+	size_t i;
+
+	/* most words are short enough that setting up isn't worth it */
+	for (i = 0; i < n && i < LEX_SHORT; i++) {
+		if (lex_class[(unsigned char)s[i]] & LEX_DELIM)
+			return i;
+	}
+	for (; i + 16 <= n; i += 16) {
+		v = _mm_loadu_si128((__m128i *)(s + i));
+		m = _mm_or_si128(space_sse2(v),
+			_mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('(')),
+					_mm_cmpeq_epi8(v, _mm_set1_epi8(')'))),
+				_mm_cmpeq_epi8(v, _mm_set1_epi8('\"'))));
+		bits = _mm_movemask_epi8(m);
+		if (bits != 0)
+			return i + __builtin_ctz(bits);
+	}
+	return i + lex_delim_scalar(s + i, n - i);
+}
+
+static size_t lex_space_sse2(char *s, size_t n) {
+	unsigned int bits;
+	size_t i;
+
+	for (i = 0; i < n && i < LEX_SHORT; i++) {
+		if (!(lex_class[(unsigned char)s[i]] & LEX_SPACE))
+			return i;
+	}
+	for (; i + 16 <= n; i += 16) {
+		bits = ~_mm_movemask_epi8(space_sse2(_mm_loadu_si128((__m128i *)(s + i)))) & 0xffff;
+		if (bits != 0)
+			return i + __builtin_ctz(bits);
+	}
+	return i + lex_space_scalar(s + i, n - i);
+}
+#endif
+
+/************************************************/
+/*****************   Reader   *******************/
+/************************************************/
+
+/* A reader of the expressions in fd, or in whatever is fed to it 
+ * if fd is -1. Input can stop anywhere, even in the middle of a 
+ * word, and picks up where it left off with the next piece */
+Reader *reader_new(int fd) {
+	Reader *r;
+
+	if (!lex_ready)
+		lex_init();
+	r = ds_malloc(sizeof(Reader));
+	if (r == NULL)
 		return NULL;
-	/* initialize buffer */
-	memset(buf, 0, MAX_WORD);
-	state = STATE_BEGIN;
-	do {
-		if (state == STATE_BEGIN) {
-			/* go to first open paren */
-			if (*ptr == '(') {
-				layer++;
-				state = STATE_OPEN_PAREN;
+	r->fd = fd;
+	r->in = NULL;
+	r->inpos = r->inlen = 0;
+	r->eof = 0;
+	r->state = STATE_BEGIN;
+	r->layer = 0;
+	r->wordlen = 0;
+	r->wordmax = MAX_WORD;
+	r->word = ds_malloc(r->wordmax);
+	r->nnodes = 0;
+	r->maxnodes = EXPR_HINT;
+	r->nodes = ds_malloc(r->maxnodes * sizeof(Expr));
+	r->strs = NULL;
+	r->strslen = r->strsmax = r->strsize = 0;
+	vector_init(&r->open, sizeof(Open));
+	if (r->word == NULL || r->nodes == NULL) {
+		free(r->word);
+		free(r->nodes);
+		free(r);
+		return NULL;
+	}
+	return r;
+}
+
+void reader_free(Reader *r) {
+	if (r == NULL)
+		return;
+	free(r->in);
+	free(r->word);
+	free(r->nodes);
+	free(r->strs);
+	vector_release(&r->open);
+	free(r);
+}
+
+/* Read the n bytes at data until an expression is complete. 
+ * Returns 1 and sets *expr if one is, 0 if all of the input was
+ * taken without finishing one and -1 on a syntax error, after 
+ * which reading starts over. *used is how many bytes were taken */
+int reader_feed(Reader *r, char *data, size_t n, size_t *used, Expr **expr) {
+	char *ptr = data, *end = data + n;
+	char *q;
+	size_t len;
+	char c;
+	int done = 0;
+	int quote;
+
+	*expr = NULL;
+	while (ptr < end && !done) {
+		if (r->state == STATE_QUOTE) {
+			/* the rest of a string */
+			q = memchr(ptr, '\"', end - ptr);
+			len = ((q != NULL) ? q : end) - ptr;
+			if (reader_append(r, ptr, len) < 0)
+				goto nomem;
+			ptr += len;
+			if (q == NULL)
+				break;
+			ptr++;
+			if (r->layer == 0) {
+				/* a string by itself, drop the closing quote */
+				if (reader_word(r) < 0)
+					goto nomem;
+				done = 1;
+			} else {
+				r->state = STATE_WORD;
 			}
-		} else if (state == STATE_OPEN_PAREN) {
-			if (*ptr == ')') {
-				layer--;
-				root = down(root);
-				state = STATE_CLOSE_PAREN;
-			} else if (*ptr == '(') {
-				layer++;
-				root = up(root);
-				state = STATE_OPEN_PAREN;
-			} else if (!is_whitespace(*ptr)) {
-				buf[i++] = *ptr;
-                                if (*ptr == '\"')
-                                        state = STATE_QUOTE;
-                                else
-                                        state = STATE_PROC;
+			continue;
+		}
+		if (r->state == STATE_WORD) {
+			len = lex_delim(ptr, end - ptr);
+			if (r->wordlen == 0 && ptr + len < end && ptr[len] != '\"') {
+				/* all of it is here, no need to copy it */
+				quote = (len == 1 && *ptr == '\'' && ptr[1] == '(');
+				if ((quote ? reader_quote(r) : reader_span(r, ptr, len)) < 0)
+					goto nomem;
+				ptr += len;
+			} else {
+				if (reader_append(r, ptr, len) < 0)
+					goto nomem;
+				ptr += len;
+				/* the rest comes with the next piece */
+				if (ptr == end)
+					break;
+				if (*ptr == '\"') {
+					if (reader_append(r, ptr++, 1) < 0)
+						goto nomem;
+					r->state = STATE_QUOTE;
+					continue;
+				}
+				quote = (r->wordlen == 1 && r->word[0] == '\'' && *ptr == '(');
+				if (quote)
+					r->wordlen = 0;
+				if ((quote ? reader_quote(r) : reader_word(r)) < 0)
+					goto nomem;
 			}
-		} else if (state == STATE_CLOSE_PAREN) {
-			if (layer < 0) {
-				state = STATE_ERROR;
-				printf("error: too many close parens\n");
-			} else if (*ptr == ')') {
-				/* go to next buf */
-				layer--;
-				root = down(root);
-				state = STATE_CLOSE_PAREN;
-			} else if (*ptr == '(') {
-				layer++;
-				root = up(root);
-				state = STATE_OPEN_PAREN;
-			} else if (!is_whitespace(*ptr)) {
-				buf[i++] = *ptr;
-				state = STATE_ARG;
+			/* the word is over */
+			if (r->layer == 0) {
+				/* leave the paren that ended it */
+				if (is_whitespace(*ptr))
+					ptr++;
+				done = 1;
+				continue;
 			}
-		} else if (state == STATE_PROC || state == STATE_ARG) {
-			if (buf[0] != '\0' && (is_whitespace(*ptr) || *ptr == ')')) {
-				/* terminate buf */
-				buf[i] = '\0';
-				if (state == STATE_PROC) {
-					/* malloc() failed somewhere */
-					if (expr_insert_word(root, strdup(buf), TYPE_PROC) < 0) {
-						state = STATE_ERROR;
-						printf("error: memory error\n");
-					}
-				} else {
-					if (expr_insert_word(root, strdup(buf), TYPE_ARG) < 0) {
-						state = STATE_ERROR;
-						printf("error: memory error\n");
-					}
-				}
-				/* reset buf */
-				buf[0] = '\0';
-				i = 0;
-				/* read next buf or close paren */
-				state = STATE_ARG;
+			r->state = STATE_LIST;
+		}
+		/* between words */
+		ptr += lex_space(ptr, end - ptr);
+		if (ptr == end)
+			break;
+		c = *ptr;
+		if (r->state == STATE_BEGIN) {
+			if (c == ')') {
+				*used = ++ptr - data;
+				return reader_error(r, "too many close parens");
 			}
-			if (*ptr == ')') {
-				layer--;
-				root = down(root);
-				state = STATE_CLOSE_PAREN;
-			} else if (*ptr == '(') {
-				layer++;
-				root = up(root);
-				state = STATE_OPEN_PAREN;
-			} else if (!is_whitespace(*ptr)) {
-				buf[i++] = *ptr;
-                                if (*ptr == '\"')
-                                        state = STATE_QUOTE;
-                        } else if (*ptr == '\"') {
-                                state = STATE_QUOTE;
-                        }
-		} else if (state == STATE_QUOTE) {
-                        if (*ptr == '\"')
-                                state = STATE_ARG;
-                        else
-                                buf[i++] = *ptr;
-                }
-                ptr++;
-	} while (*ptr != '\0' && state != STATE_ERROR);
-	/* not a function call, return value instead */
-	if (state != STATE_ERROR && state == STATE_BEGIN) {
-		tree_set_data(root, strdup(exp));
-	} else if (state != STATE_ERROR && layer > 0) {
-		printf("error: too many open parens\n");
-		state = STATE_ERROR;
-	} 
-	if (state == STATE_ERROR) {
-		expr_free(root);
-		root = NULL;
-	}
-
-	return root;
-}
-
-/* go up a level */
-static Tree *up(Tree *t) {
-	return tree_insert_child(t, NULL);
-}
-
-/* go down a level */
-static Tree *down(Tree *t) {
-	if (t->parent == NULL)
-		return t;
-	return tree_parent(t);
-}
-
-/* add a procedure or argument */
-static int expr_insert_word(Tree *t, void *data, int type) {
-	if (tree_insert_child(t, data) == NULL)
+			reader_start(r);
+		}
+		if (c == '(') {
+			if (reader_open(r) < 0)
+				goto nomem;
+			r->layer++;
+			r->state = STATE_LIST;
+			ptr++;
+		} else if (c == ')') {
+			ptr++;
+			r->layer -= reader_close(r);
+			if (r->layer == 0)
+				done = 1;
+		} else if (c == '\"') {
+			if (reader_append(r, ptr++, 1) < 0)
+				goto nomem;
+			r->state = STATE_QUOTE;
+		} else {
+			r->state = STATE_WORD;
+		}
+	}
+	*used = ptr - data;
+	if (!done)
+		return 0;
+	if ((*expr = reader_take(r)) == NULL)
+		return reader_error(r, "memory error");
+	r->state = STATE_BEGIN;
+	return 1;
+nomem:
+	/* don't get stuck on the same byte */
+	*used = ptr - data + (ptr < end);
+	return reader_error(r, "memory error");
+}
+
+/* The input has ended, return the expression it finished 
+ * like reader_feed, 0 if there wasn't one */
+int reader_end(Reader *r, Expr **expr) {
+	*expr = NULL;
+	if (r->state == STATE_BEGIN)
+		return 0;
+	if (r->layer > 0)
+		return reader_error(r, "too many open parens");
+	/* a word or string by itself */
+	if (reader_word(r) < 0 || (*expr = reader_take(r)) == NULL)
+		return reader_error(r, "memory error");
+	r->state = STATE_BEGIN;
+	return 1;
+}
+
+/* Read the next expression from the reader's file, returns
+ * like reader_feed but with 0 at the end of the file */
+int reader_next(Reader *r, Expr **expr) {
+	size_t used;
+	ssize_t n;
+	int retval;
+
+	*expr = NULL;
+	if (r->in == NULL && (r->in = ds_malloc(READ_CHUNK)) == NULL)
 		return -1;
+	for (;;) {
+		if (r->inpos < r->inlen) {
+			retval = reader_feed(r, r->in + r->inpos, 
+					r->inlen - r->inpos, &used, expr);
+			r->inpos += used;
+			if (retval != 0)
+				return retval;
+		}
+		if (r->eof || r->fd < 0)
+			return reader_end(r, expr);
+		n = read(r->fd, r->in, READ_CHUNK);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			r->eof = 1;
+			continue;
+		}
+		r->inpos = 0;
+		r->inlen = n;
+	}
+}
+
+/* start reading an expression */
+static void reader_start(Reader *r) {
+	r->nnodes = 0;
+	r->strslen = r->strsize = 0;
+	vector_clear(&r->open);
+	r->layer = 0;
+	r->wordlen = 0;
+}
+
+/* Add a node to the expression, as the last child of the list 
+ * being read if there is one. The pointer is good until the next 
+ * node is added, since the array can move */
+static Expr *reader_node(Reader *r, int kind) {
+	Expr *e, *nodes;
+	Open *o;
+	uint32_t i;
+
+	if (r->nnodes == r->maxnodes) {
+		nodes = ds_realloc(r->nodes, 2 * r->maxnodes * sizeof(Expr));
+		if (nodes == NULL)
+			return NULL;
+		r->nodes = nodes;
+		r->maxnodes *= 2;
+	}
+	i = r->nnodes++;
+	e = &r->nodes[i];
+	e->kind = kind;
+	e->form = 0;
+	e->count = 0;
+	e->next = 0;
+	e->size = 1;
+	if ((o = vector_last(&r->open)) != NULL) {
+		if (o->last != 0)
+			r->nodes[o->last].next = i - o->last;
+		o->last = i;
+		r->nodes[o->list].count++;
+	}
+	return e;
+}
+
+/* a list begins */
+static int reader_open(Reader *r) {
+	Expr *e;
+	Open o;
+
+	e = reader_node(r, EXPR_LIST);
+	if (e == NULL)
+		return -1;
+	e->proto = NULL;
+	o.list = e - r->nodes;
+	o.last = 0;
+	o.quote = 0;
+	return vector_push(&r->open, &o) ? 0 : -1;
+}
+
+/* the innermost list is complete, and so are the quotes
+ * that were waiting for it. Returns how many lists closed */
+static int reader_close(Reader *r) {
+	Open *o;
+	int n = 0;
+
+	do {
+		o = vector_last(&r->open);
+		r->nodes[o->list].size = r->nnodes - o->list;
+		vector_pop(&r->open);
+		n++;
+	} while ((o = vector_last(&r->open)) != NULL && o->quote);
+	return n;
+}
+
+/* a ' right before a paren, which reads as (quote (...)) */
+static int reader_quote(Reader *r) {
+	Open *o;
+
+	if (reader_open(r) < 0 || reader_span(r, "quote", 5) < 0)
+		return -1;
+	o = vector_last(&r->open);
+	o->quote = 1;
+	r->layer++;
 	return 0;
 }
 
+/* Hand over the expression that was read, the reader keeps
+ * its room for the next one. Its string literals go after 
+ * the nodes, so they're freed along with them */
+static Expr *reader_take(Reader *r) {
+	Expr *e;
+	char *to, *name;
+	uint32_t i;
+
+	e = ds_malloc(r->nnodes * sizeof(Expr) + r->strsize);
+	if (e == NULL)
+		return NULL;
+	memcpy(e, r->nodes, r->nnodes * sizeof(Expr));
+	to = (char *)(e + r->nnodes);
+	for (i = 0; r->strsize > 0 && i < r->nnodes; i++) {
+		if (e[i].kind != EXPR_STRING)
+			continue;
+		/* until now it was where the text was in strs */
+		name = r->strs + e[i].atom.slot;
+		e[i].atom.symbol = string_put(to, name, strlen(name));
+		e[i].atom.slot = 0;
+		to += STRING_SIZE(strlen(name));
+	}
+	r->nnodes = 0;
+	r->strslen = r->strsize = 0;
+	return e;
+}
+
+/* add n characters to the word being read */
+static int reader_append(Reader *r, char *s, size_t n) {
+	char *w;
+	size_t max = r->wordmax;
+
+	while (r->wordlen + n > max)
+		max *= 2;
+	if (max != r->wordmax) {
+		w = ds_realloc(r->word, max);
+		if (w == NULL)
+			return -1;
+		r->word = w;
+		r->wordmax = max;
+	}
+	memcpy(r->word + r->wordlen, s, n);
+	r->wordlen += n;
+	return 0;
+}
+
+/* the word being read is complete, add it to the expression */
+static int reader_word(Reader *r) {
+	size_t n = r->wordlen;
+
+	r->wordlen = 0;
+	return reader_span(r, r->word, n);
+}
+
+/* add the n characters at s as a word of the expression,
+ * literals get their value now so nobody has to work it out again */
+static int reader_span(Reader *r, char *s, size_t n) {
+	Expr *e;
+	Symbol *sym;
+	Open *o;
+	uint64_t v;
+
+	if (is_num(s, n)) {
+		if (parse_num(s, n, &v) < 0 || (e = reader_node(r, EXPR_NUM)) == NULL)
+			return -1;
+		e->value = v;
+		return 0;
+	}
+	if (n == 2 && s[0] == '#' && (s[1] == 't' || s[1] == 'f')) {
+		if ((e = reader_node(r, EXPR_BOOL)) == NULL)
+			return -1;
+		e->value = value_bool(s[1] == 't');
+		return 0;
+	}
+	if (*s == '\'' || *s == '\"')
+		return reader_string(r, s, n);
+	sym = intern_span(s, n);
+	if (sym == NULL)
+		return -1;
+	e = reader_node(r, EXPR_SYMBOL);
+	if (e == NULL)
+		return -1;
+	e->atom.symbol = sym;
+	e->atom.depth = ATOM_FREE;
+	e->atom.slot = 0;
+	/* the first word of a list tells which form it is */
+	o = vector_last(&r->open);
+	if (o != NULL && r->nodes[o->list].count == 1)
+		r->nodes[o->list].form = sym->form;
+	return 0;
+}
+
+/* A string literal isn't interned, or a file full of them would
+ * fill the symbol table for good. Its text is kept with the rest
+ * of the expression's, and the node knows where until it's taken */
+static int reader_string(Reader *r, char *s, size_t n) {
+	Expr *e;
+	char *strs;
+	size_t max = (r->strsmax) ? r->strsmax : MAX_WORD;
+
+	while (r->strslen + n + 1 > max)
+		max *= 2;
+	if (max != r->strsmax) {
+		strs = ds_realloc(r->strs, max);
+		if (strs == NULL)
+			return -1;
+		r->strs = strs;
+		r->strsmax = max;
+	}
+	if ((e = reader_node(r, EXPR_STRING)) == NULL)
+		return -1;
+	e->atom.symbol = NULL;
+	e->atom.depth = ATOM_FREE;
+	e->atom.slot = r->strslen;
+	memcpy(r->strs + r->strslen, s, n);
+	r->strs[r->strslen + n] = '\0';
+	r->strslen += n + 1;
+	r->strsize += STRING_SIZE(n);
+	return 0;
+}
+
+/* Lay out a string literal at to the way a symbol is, without
+ * interning it, so its name is found the same way */
+static Symbol *string_put(char *to, char *name, size_t n) {
+	Symbol *sym = (Symbol *)to;
+
+	sym->name = (char *)(sym + 1);
+	memcpy(sym->name, name, n);
+	sym->name[n] = '\0';
+	sym->hash = 0;
+	sym->form = 0;
+	sym->next = NULL;
+	return sym;
+}
+
+/* Return non-zero if the word is a real number */
+static int is_num(char *s, size_t n) {
+	int decimalcount = 0;
+	size_t i = 0;
+
+	if (n == 0)
+		return 0;
+	/* check sign */
+	if (*s == '-') {
+		if (n == 1)
+			return 0;
+		i++;
+	}
+	for (; i < n; i++) {
+		if (s[i] == '.') {
+			if (++decimalcount > 1)
+				return 0;
+		} else if (!isdigit((unsigned char)s[i])) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* convert a numeric word to a fixnum, or a flonum if it
+ * has a decimal point or doesn't fit */
+static int parse_num(char *s, size_t n, uint64_t *v) {
+	char buf[64], *t = buf;
+	long l;
+
+	/* the word needn't be terminated */
+	if (n >= sizeof(buf) && (t = ds_malloc(n + 1)) == NULL)
+		return -1;
+	memcpy(t, s, n);
+	t[n] = '\0';
+	l = strtol(t, NULL, 10);
+	if (memchr(t, '.', n) == NULL && l >= INT32_MIN && l <= INT32_MAX)
+		*v = value_fixnum(l);
+	else
+		*v = value_flonum(strtod(t, NULL));
+	if (t != buf)
+		free(t);
+	return 0;
+}
+
+/* throw away what was read so far */
+static int reader_error(Reader *r, char *msg) {
+	fprintf(stderr, "error: %s\n", msg);
+	reader_start(r);
+	r->state = STATE_BEGIN;
+	return -1;
+}
+
+/* parse the first expression of a string */
+Expr *parse(char *exp) {
+	Reader *r;
+	Expr *expr;
+	size_t used;
+
+	r = reader_new(-1);
+	if (r == NULL)
+		return NULL;
+	if (reader_feed(r, exp, strlen(exp), &used, &expr) == 0)
+		reader_end(r, &expr);
+	reader_free(r);
+	return expr;
+}
+
 /************************************************/
-/****************   Expr API  *******************/
+/****************   Symbols   *******************/
 /************************************************/
 
-/* return the next word or sub-expression in the expression */
-Expr *expr_next(Expr *expr) {
-	if (expr == NULL)
+/* return the unique symbol for name, creating it if needed */
+Symbol *intern(char *name) {
+	if (name == NULL)
 		return NULL;
-	return tree_next(expr);
+	return intern_span(name, strlen(name));
 }
 
-/* return the first word or sub-expression of the parent expression */
-Expr *expr_child(Expr *parent) {
-	if (parent == NULL)
+/* intern the n characters at name, which needn't be terminated */
+Symbol *intern_span(char *name, size_t n) {
+	Symbol *sym;
+	unsigned int hash, h;
+
+	if (symtab_count >= symtab_size && symtab_grow() < 0)
 		return NULL;
-	/* if the expression is just a single word
-	 * return null */
-	if (expr_is_word(parent))
+	hash = symbol_hash(name, n);
+	h = hash & (symtab_size - 1);
+	for (sym = symtab[h]; sym; sym = sym->next) {
+		if (sym->hash == hash && !strncmp(sym->name, name, n) && sym->name[n] == '\0')
+			return sym;
+	}
+	/* first time we see this word, its name follows it */
+	sym = ds_malloc(sizeof(Symbol) + n + 1);
+	if (sym == NULL)
 		return NULL;
-	return tree_child(parent);
+	sym->name = (char *)(sym + 1);
+	memcpy(sym->name, name, n);
+	sym->name[n] = '\0';
+	sym->hash = hash;
+	sym->form = 0;
+	sym->next = symtab[h];
+	symtab[h] = sym;
+	symtab_count++;
+	return sym;
 }
 
-/* if the expression consists of a single
- * root node pointing to a string it is a word */
-int expr_is_word(Expr *expr) {
-	/* we need this here because an empty list is
-	 * also a tree, so we check if it points to a word */
-	if (expr_get_word(expr) != NULL)
-		return tree_is_leaf(expr);
+/* FNV-1a */
+static unsigned int symbol_hash(char *name, size_t n) {
+	unsigned int h = 2166136261u;
+
+	for (; n > 0; name++, n--) {
+		h ^= (unsigned char)*name;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/* double the number of chains and rehash */
+static int symtab_grow(void) {
+	Symbol **old = symtab, *sym, *next;
+	unsigned int oldsize = symtab_size, i, h;
+	unsigned int size = (oldsize) ? oldsize * 2 : SYMTAB_MIN;
+
+	symtab = ds_calloc(size, sizeof(Symbol *));
+	if (symtab == NULL) {
+		symtab = old;
+		return -1;
+	}
+	symtab_size = size;
+	for (i = 0; i < oldsize; i++) {
+		for (sym = old[i]; sym; sym = next) {
+			next = sym->next;
+			h = sym->hash & (size - 1);
+			sym->next = symtab[h];
+			symtab[h] = sym;
+		}
+	}
+	free(old);
 	return 0;
 }
 
-/* if it's not a word, its a list and contains
-   a NULL root tree with one or more children trees */
+/************************************************/
+/****************   Expr API  *******************/
+/************************************************/
+
+/* if it's not a word, its a list */
 int expr_is_list(Expr *expr) {
 	return !expr_is_word(expr);
 }
 
-/* if it's an empty list then the expression will be 
- * a single root with a NULL pointer to its data */
 int expr_is_emptylist(Expr *expr) {
-	if (expr_get_word(expr) == NULL)
-		return tree_is_leaf(expr);
-	return 0;
+	return (expr != NULL && expr->kind == EXPR_LIST && expr->count == 0);
 }
 
-/* return the word pointed to by the datum of expr */
+/* return the name of a symbol or string, NULL for anything else */
 char *expr_get_word(Expr *expr) {
 	if (expr == NULL)
 		return NULL;
-	return (char *)expr->data;
+	if (expr->kind != EXPR_SYMBOL && expr->kind != EXPR_STRING)
+		return NULL;
+	return expr->atom.symbol->name;
 }
 
-/* return the number of words or sub-expressions in the expression */
-int expr_len(Expr *expr) {
-	if (expr == NULL)
-		return -1;
-        if (expr_is_word(expr))
-                return -1;
-	return tree_count_children(expr);
+/* return the interned symbol of a word, strings don't have one */
+Symbol *expr_get_symbol(Expr *expr) {
+	Atom *atom = expr_get_atom(expr);
+
+	return (atom == NULL) ? NULL : atom->symbol;
+}
+
+/* return the word along with its lexical address, only
+ * symbols have one */
+Atom *expr_get_atom(Expr *expr) {
+	if (expr == NULL || expr->kind != EXPR_SYMBOL)
+		return NULL;
+	return &expr->atom;
 }
 
+/* Copy the nodes of an expression, symbols are shared. The
+ * string literals in it are copied after the nodes */
 Expr *expr_copy(Expr *orig) {
-        Expr *copy;
+	Expr *copy;
+	char *to, *name;
+	size_t strsize = 0;
+	uint32_t i;
+
+	if (orig == NULL)
+		return NULL;
+	for (i = 0; i < orig->size; i++) {
+		if (orig[i].kind == EXPR_STRING)
+			strsize += STRING_SIZE(strlen(orig[i].atom.symbol->name));
+	}
+	copy = ds_malloc(orig->size * sizeof(Expr) + strsize);
+	if (copy == NULL)
+		return NULL;
+	memcpy(copy, orig, orig->size * sizeof(Expr));
+	to = (char *)(copy + orig->size);
+	for (i = 0; strsize > 0 && i < orig->size; i++) {
+		if (copy[i].kind != EXPR_STRING)
+			continue;
+		name = copy[i].atom.symbol->name;
+		copy[i].atom.symbol = string_put(to, name, strlen(name));
+		to += STRING_SIZE(strlen(name));
+	}
+	/* orig may be part of a bigger expression */
+	copy->next = 0;
+	return copy;
+}
+
+/* Turn a node into a number or boolean literal. Whatever was
+ * below it is left in place, unused */
+void expr_set_value(Expr *expr, int kind, uint64_t value) {
+	expr->kind = kind;
+	expr->form = 0;
+	expr->count = 0;
+	expr->value = value;
+}
 
-        if (orig == NULL)
-                return NULL;
-        copy = tree_copy(orig);
-        tree_traverse(copy, expr_copy_helper);
+/* put the subtree with, which is somewhere below expr, in the
+ * place of expr. What's left of expr stays until expr_compact */
+void expr_replace(Expr *expr, Expr *with) {
+	uint32_t next = expr->next;
 
-        return copy;
+	memmove(expr, with, with->size * sizeof(Expr));
+	expr->next = next;
 }
 
-/* replace each data with a newly allocated string */
-static void expr_copy_helper(Expr *copy) {
-        if (copy->data == NULL)
-                return;
-        copy->data = strdup((char *)copy->data);
+/* unlink the child of parent that comes after prev, its
+ * nodes stay until expr_compact */
+void expr_remove_next(Expr *parent, Expr *prev) {
+	Expr *dead = expr_next(prev);
+
+	if (dead == NULL)
+		return;
+	prev->next = (dead->next != 0) ? prev->next + dead->next : 0;
+	parent->count--;
 }
 
-/* free an expression */
-void expr_free(Expr *e) {
-	tree_traverse(e, expr_free_helper);
-	tree_free(e);
+/* Move the nodes still linked into a root expression down over
+ * the ones expr_replace and expr_remove_next left, so its size
+ * counts only what's in it */
+void expr_compact(Expr *root) {
+	expr_pack(root, root);
 }
 
-/* wrapper */
-static void expr_free_helper(Expr *e) {
-        free(e->data);
+/* Copy expr and what's below it to to, which is never past it.
+ * Children come after their parent and siblings after each
+ * other, so nothing is written over before it's been read.
+ * Returns the number of nodes it takes now */
+static uint32_t expr_pack(Expr *expr, Expr *to) {
+	Expr *child = expr_child(expr), *next, *last = NULL;
+	uint32_t size = 1;
+
+	*to = *expr;
+	for (; child; child = next) {
+		next = expr_next(child);
+		if (last != NULL)
+			last->next = (to + size) - last;
+		last = to + size;
+		size += expr_pack(child, last);
+	}
+	if (last != NULL)
+		last->next = 0;
+	to->size = size;
+	return size;
+}
+
+/* free a whole expression, which has to be the root
+ * returned by parse or expr_copy */
+void expr_free(Expr *e) {
+	free(e);
 }
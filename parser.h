@@ -1,20 +1,149 @@
 /* skm - scheme interpreter
  * author: Eugene Ma (edma2) */
 
+#ifndef PARSER_H
+#define PARSER_H
+#include <stdint.h>
 #ifndef DS_H
 #define DS_H
 #include "ds/ds.h"
 #endif
 
-typedef Tree Expr;
+typedef struct Expr Expr;
+typedef struct Symbol Symbol;
+struct Primitive;
+/* every distinct word is interned exactly once,
+ * so symbols can be compared by address */
+struct Symbol {
+	char *name;
+	unsigned int hash;
+	/* the special form a list starting with it is, 0 if none */
+	int form;
+	struct Symbol *next;
+};
 
+/* a word of an expression. Variable references are given a
+ * lexical address when the lambda around them is created */
+typedef struct {
+	Symbol *symbol;
+	int depth;
+	/* of a global, the cache of where it was found, which is
+	 * kept out of the node so nodes stay 32 bytes */
+	int slot;
+} Atom;
+
+#define ATOM_FREE 	-1 	/* not resolved, search by name */
+#define ATOM_GLOBAL 	-2 	/* lives in the global frame */
+
+/* what a node is, worked out once when it's read */
+#define EXPR_LIST 	0
+#define EXPR_SYMBOL 	1
+#define EXPR_NUM 	2 	/* value is the number */
+#define EXPR_BOOL 	3 	/* value is #t or #f */
+#define EXPR_STRING 	4 	/* the name of atom starts with the quote,
+				 * and isn't interned */
+
+/* An expression is one array of nodes in the order they were
+ * read, so the first child of a list comes right after it.
+ * Offsets and sizes are counted in nodes */
+struct Expr {
+	unsigned char kind;
+	unsigned char form; 	/* of a list, from its first word */
+	uint32_t count; 	/* children of a list */
+	uint32_t next; 		/* to the next sibling, 0 if there isn't one */
+	uint32_t size; 		/* nodes in the subtree, this one included */
+	union {
+		Atom atom;
+		uint64_t value;
+		/* on a lambda form, the code that closures 
+		 * made from it share */
+		void *proto;
+		/* on a call that was folded, its value and the
+		 * primitive its operator was bound to */
+		struct {
+			uint64_t value;
+			struct Primitive *prim;
+		} fold;
+	};
+};
+
+/* Reads expressions from input that comes in pieces, what
+ * was read of an unfinished one is kept between them */
+typedef struct {
+	int fd; 		/* -1 if the input is fed in */
+	char *in; 		/* what was read from fd */
+	size_t inpos, inlen;
+	int eof;
+	int state;
+	int layer; 		/* lists open */
+	char *word; 		/* the word being read */
+	size_t wordlen, wordmax;
+	Expr *nodes; 		/* the expression being read */
+	uint32_t nnodes, maxnodes;
+	char *strs; 		/* the text of its string literals */
+	size_t strslen, strsmax;
+	size_t strsize; 	/* what they'll take after the nodes */
+	Vector open; 		/* where the lists being read are */
+} Reader;
+
+Symbol *intern(char *name);
+Symbol *intern_span(char *name, size_t n);
 Expr *parse(char *exp);
+Reader *reader_new(int fd);
+void reader_free(Reader *r);
+int reader_feed(Reader *r, char *data, size_t n, size_t *used, Expr **expr);
+int reader_end(Reader *r, Expr **expr);
+int reader_next(Reader *r, Expr **expr);
+char *lex_name(void);
 Expr *expr_copy(Expr *orig);
-Expr *expr_next(Expr *expr);
-Expr *expr_child(Expr *expr);
 char *expr_get_word(Expr *expr);
+Symbol *expr_get_symbol(Expr *expr);
+Atom *expr_get_atom(Expr *expr);
 void expr_free(Expr *e);
 int expr_is_emptylist(Expr *expr);
 int expr_is_list(Expr *expr);
-int expr_is_word(Expr *expr);
-int expr_len(Expr *expr);
+void expr_set_value(Expr *expr, int kind, uint64_t value);
+void expr_replace(Expr *expr, Expr *with);
+void expr_remove_next(Expr *parent, Expr *prev);
+void expr_compact(Expr *root);
+
+/* return the next word or sub-expression in the expression */
+static inline Expr *expr_next(Expr *expr) {
+	if (expr == NULL || expr->next == 0)
+		return NULL;
+	return expr + expr->next;
+}
+
+/* return the first word or sub-expression of a list, 
+ * words don't have any */
+static inline Expr *expr_child(Expr *parent) {
+	if (parent == NULL || parent->count == 0)
+		return NULL;
+	return parent + 1;
+}
+
+static inline int expr_is_word(Expr *expr) {
+	return (expr != NULL && expr->kind != EXPR_LIST);
+}
+
+/* return the number of words or sub-expressions in a list, 
+ * -1 for a word */
+static inline int expr_len(Expr *expr) {
+	if (expr == NULL || expr->kind != EXPR_LIST)
+		return -1;
+	return expr->count;
+}
+
+static inline int expr_kind(Expr *expr) {
+	return expr->kind;
+}
+
+static inline int expr_form(Expr *expr) {
+	return (expr == NULL) ? 0 : expr->form;
+}
+
+/* the pre-parsed value of a number or boolean */
+static inline uint64_t expr_get_value(Expr *expr) {
+	return expr->value;
+}
+#endif
@@ -0,0 +1,195 @@
+/* skm - scheme interpreter
+ * author: Eugene Ma (edma2) */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "gc.h"
+
+#define PORT_BUFSIZE 	65536
+
+static Port *port_new(int fd, char *name);
+static void port_free(Port *p);
+static int write_all(int fd, char *s, size_t n);
+
+Port *port_stdout = NULL;
+static Port *ports = NULL;
+
+/************************************************/
+/****************   Interface   *****************/
+/************************************************/
+
+int port_init(void) {
+	port_stdout = port_new(STDOUT_FILENO, "stdout");
+	return (port_stdout == NULL) ? -1 : 0;
+}
+
+/* a port that writes filename from the start */
+Port *port_open(char *filename) {
+	Port *p;
+	int fd;
+
+	fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0)
+		return NULL;
+	p = port_new(fd, filename);
+	if (p == NULL)
+		close(fd);
+	return p;
+}
+
+int port_write(Port *p, char *s, size_t n) {
+	if (p->fd < 0)
+		return -1;
+	if (p->len + n > p->size && port_flush(p) < 0)
+		return -1;
+	/* too big to be worth copying */
+	if (n >= p->size)
+		return write_all(p->fd, s, n);
+	memcpy(p->buf + p->len, s, n);
+	p->len += n;
+	if (p->tty && memchr(s, '\n', n) != NULL)
+		return port_flush(p);
+	return 0;
+}
+
+int port_puts(Port *p, char *s) {
+	return port_write(p, s, strlen(s));
+}
+
+int port_printf(Port *p, char *fmt, ...) {
+	va_list ap;
+	char small[128];
+	char *s = small;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(small, sizeof(small), fmt, ap);
+	va_end(ap);
+	if (n < 0)
+		return -1;
+	/* didn't fit, print it again into something that does */
+	if ((size_t)n >= sizeof(small)) {
+		s = ds_malloc(n + 1);
+		if (s == NULL)
+			return -1;
+		va_start(ap, fmt);
+		vsnprintf(s, n + 1, fmt, ap);
+		va_end(ap);
+	}
+	n = port_write(p, s, n);
+	if (s != small)
+		free(s);
+	return n;
+}
+
+/* hand everything written so far to the file */
+int port_flush(Port *p) {
+	int retval;
+
+	if (p->fd < 0)
+		return -1;
+	retval = write_all(p->fd, p->buf, p->len);
+	p->len = 0;
+	return retval;
+}
+
+/* Flush and close the file, and give back the buffer. The
+ * port stays around while values can still refer to it, but
+ * can't be written */
+int port_close(Port *p) {
+	int retval;
+
+	if (p->fd < 0)
+		return 0;
+	retval = port_flush(p);
+	if (p->fd != STDOUT_FILENO && close(p->fd) < 0)
+		retval = -1;
+	p->fd = -1;
+	free(p->buf);
+	p->buf = NULL;
+	p->size = 0;
+	return retval;
+}
+
+/* Close and free the ports that weren't marked, which flushes
+ * what was left in them, and unmark the rest. Standard output
+ * is kept whether it was marked or not. Returns the number of
+ * ports freed */
+long port_sweep(void) {
+	Port **link = &ports, *p;
+	long freed = 0;
+
+	while ((p = *link) != NULL) {
+		if (p->mark || p == port_stdout) {
+			p->mark = 0;
+			link = &p->next;
+		} else {
+			*link = p->next;
+			port_free(p);
+			freed++;
+		}
+	}
+	return freed;
+}
+
+/* close every port, at exit */
+void port_free_all(void) {
+	Port *p, *next;
+
+	for (p = ports; p; p = next) {
+		next = p->next;
+		port_free(p);
+	}
+	ports = NULL;
+	port_stdout = NULL;
+}
+
+static Port *port_new(int fd, char *name) {
+	Port *p;
+
+	gc_poll();
+	p = ds_malloc(sizeof(Port));
+	if (p == NULL)
+		return NULL;
+	p->name = ds_strdup(name);
+	p->buf = ds_malloc(PORT_BUFSIZE);
+	if (p->name == NULL || p->buf == NULL) {
+		free(p->name);
+		free(p->buf);
+		free(p);
+		return NULL;
+	}
+	p->fd = fd;
+	p->tty = isatty(fd);
+	p->len = 0;
+	p->size = PORT_BUFSIZE;
+	p->mark = 0;
+	p->next = ports;
+	ports = p;
+	return p;
+}
+
+static void port_free(Port *p) {
+	port_close(p);
+	free(p->name);
+	free(p);
+}
+
+static int write_all(int fd, char *s, size_t n) {
+	ssize_t w;
+
+	while (n > 0) {
+		w = write(fd, s, n);
+		if (w < 0 && errno == EINTR)
+			continue;
+		if (w < 0)
+			return -1;
+		s += w;
+		n -= w;
+	}
+	return 0;
+}
@@ -0,0 +1,36 @@
+/* skm - scheme interpreter
+ * author: Eugene Ma (edma2) */
+#ifndef PORT_H
+#define PORT_H
+#include <stddef.h>
+
+/* An output port collects what's written to it and hands it
+ * to the file in big pieces. One on a terminal also passes
+ * each line on as soon as it's finished */
+typedef struct Port Port;
+struct Port {
+	char *name;
+	int fd; 		/* -1 once closed */
+	int tty;
+	char *buf; 		/* NULL once closed */
+	size_t len;
+	size_t size;
+	/* set while the collector finds it reachable */
+	int mark;
+	/* every port there is */
+	Port *next;
+};
+
+/* the port standard output goes through */
+extern Port *port_stdout;
+
+int port_init(void);
+Port *port_open(char *filename);
+int port_write(Port *p, char *s, size_t n);
+int port_puts(Port *p, char *s);
+int port_printf(Port *p, char *fmt, ...);
+int port_flush(Port *p);
+int port_close(Port *p);
+long port_sweep(void);
+void port_free_all(void);
+#endif
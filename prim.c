@@ -0,0 +1,445 @@
+/* skm - scheme interpreter
+ * author: Eugene Ma (edma2) */
+#include "prim.h"
+#include "gc.h"
+
+/* comparison operators */
+enum { CMP_EQ, CMP_LT, CMP_GT, CMP_LE, CMP_GE };
+
+static int arith(char op, int argc, Value *argv, Value *result);
+static int compare(int op, int argc, Value *argv, Value *result);
+static int equal(Value a, Value b);
+static int prim_add(int argc, Value *argv, Value *result);
+static int prim_sub(int argc, Value *argv, Value *result);
+static int prim_mul(int argc, Value *argv, Value *result);
+static int prim_div(int argc, Value *argv, Value *result);
+static int prim_eq(int argc, Value *argv, Value *result);
+static int prim_lt(int argc, Value *argv, Value *result);
+static int prim_gt(int argc, Value *argv, Value *result);
+static int prim_le(int argc, Value *argv, Value *result);
+static int prim_ge(int argc, Value *argv, Value *result);
+static int prim_display(int argc, Value *argv, Value *result);
+static int prim_newline(int argc, Value *argv, Value *result);
+static int prim_flush_output(int argc, Value *argv, Value *result);
+static int prim_open_output_file(int argc, Value *argv, Value *result);
+static int prim_close_output_port(int argc, Value *argv, Value *result);
+static int prim_current_output_port(int argc, Value *argv, Value *result);
+static int prim_gc(int argc, Value *argv, Value *result);
+static int prim_cons(int argc, Value *argv, Value *result);
+static int prim_car(int argc, Value *argv, Value *result);
+static int prim_cdr(int argc, Value *argv, Value *result);
+static int prim_pair(int argc, Value *argv, Value *result);
+static int prim_null(int argc, Value *argv, Value *result);
+static int prim_list(int argc, Value *argv, Value *result);
+static Pair *get_pair(Value v);
+static Port *output_port(int argc, Value *argv, int i);
+
+/* the primitive procedures of the initial environment */
+static Primitive primitives[] = {
+	{ "+", 		prim_add, 	0, ARGS_ANY, 1 },
+	{ "-", 		prim_sub, 	1, ARGS_ANY, 1 },
+	{ "*", 		prim_mul, 	0, ARGS_ANY, 1 },
+	{ "/", 		prim_div, 	1, ARGS_ANY, 1 },
+	{ "=", 		prim_eq, 	1, ARGS_ANY, 1 },
+	{ "<", 		prim_lt, 	1, ARGS_ANY, 1 },
+	{ ">", 		prim_gt, 	1, ARGS_ANY, 1 },
+	{ "<=", 	prim_le, 	1, ARGS_ANY, 1 },
+	{ ">=", 	prim_ge, 	1, ARGS_ANY, 1 },
+	{ "display", 	prim_display, 	1, 2, 0 },
+	{ "newline", 	prim_newline, 	0, 1, 0 },
+	{ "flush-output", prim_flush_output, 0, 1, 0 },
+	{ "open-output-file", prim_open_output_file, 1, 1, 0 },
+	{ "close-output-port", prim_close_output_port, 1, 1, 0 },
+	{ "current-output-port", prim_current_output_port, 0, 0, 0 },
+	{ "gc", 	prim_gc, 	0, 0, 0 },
+	{ "cons", 	prim_cons, 	2, 2, 0 },
+	{ "car", 	prim_car, 	1, 1, 0 },
+	{ "cdr", 	prim_cdr, 	1, 1, 0 },
+	{ "pair?", 	prim_pair, 	1, 1, 1 },
+	{ "null?", 	prim_null, 	1, 1, 1 },
+	{ "list", 	prim_list, 	0, ARGS_ANY, 0 },
+	{ NULL, 	NULL, 		0, 0, 0 }
+};
+
+/************************************************/
+/****************   Registry   ******************/
+/************************************************/
+
+/* Populate the initial environment with primitive procedures */
+void prim_init(Env *env) {
+	Primitive *prim;
+
+	if (env == NULL)
+		return;
+	for (prim = primitives; prim->name != NULL; prim++)
+		prim_register(env, prim);
+}
+
+/* Bind name to a procedure that calls prim->fn. The descriptor
+ * isn't copied and has to outlive the environment */
+int prim_register(Env *env, Primitive *prim) {
+	Lambda *proc;
+	Bind *bind;
+
+	if (env == NULL || prim == NULL || prim->fn == NULL)
+		return -1;
+	proc = lambda_new(env, NULL);
+	if (proc == NULL)
+		return -1;
+	proc->prim = prim;
+	proc->name = intern(prim->name);
+	bind = bind_new(proc->name, value_ptr(TAG_LAMBDA, proc));
+	if (bind == NULL) {
+		lambda_free(proc);
+		return -1;
+	}
+	if (bind_add(env, bind) == NULL) {
+		bind_free(bind);
+		return -1;
+	}
+	return 0;
+}
+
+/* apply a primitive to argc values, which are only borrowed */
+int apply_primitive(Lambda *proc, int argc, Value *argv, Value *result) {
+        Primitive *prim = proc->prim;
+
+        if (argc < prim->min || (prim->max != ARGS_ANY && argc > prim->max)) {
+                fprintf(stderr, "skm: wrong number of arguments\n");
+                return RETVAL_ERROR;
+        }
+        return prim->fn(argc, argv, result);
+}
+
+/************************************************/
+/****************   Primitives   ****************/
+/************************************************/
+
+static int prim_add(int argc, Value *argv, Value *result) {
+        return arith('+', argc, argv, result);
+}
+
+static int prim_sub(int argc, Value *argv, Value *result) {
+        return arith('-', argc, argv, result);
+}
+
+static int prim_mul(int argc, Value *argv, Value *result) {
+        return arith('*', argc, argv, result);
+}
+
+static int prim_div(int argc, Value *argv, Value *result) {
+        return arith('/', argc, argv, result);
+}
+
+static int prim_eq(int argc, Value *argv, Value *result) {
+        return compare(CMP_EQ, argc, argv, result);
+}
+
+static int prim_lt(int argc, Value *argv, Value *result) {
+        return compare(CMP_LT, argc, argv, result);
+}
+
+static int prim_gt(int argc, Value *argv, Value *result) {
+        return compare(CMP_GT, argc, argv, result);
+}
+
+static int prim_le(int argc, Value *argv, Value *result) {
+        return compare(CMP_LE, argc, argv, result);
+}
+
+static int prim_ge(int argc, Value *argv, Value *result) {
+        return compare(CMP_GE, argc, argv, result);
+}
+
+/* output goes to the port given last, or standard output */
+static int prim_display(int argc, Value *argv, Value *result) {
+        Port *port = output_port(argc, argv, 1);
+
+        if (port == NULL)
+                return RETVAL_ERROR;
+        value_print(port, argv[0]);
+        *result = VALUE_EMPTY;
+        return RETVAL_ATOM;
+}
+
+static int prim_newline(int argc, Value *argv, Value *result) {
+        Port *port = output_port(argc, argv, 0);
+
+        if (port == NULL)
+                return RETVAL_ERROR;
+        port_write(port, "\n", 1);
+        *result = VALUE_EMPTY;
+        return RETVAL_ATOM;
+}
+
+static int prim_flush_output(int argc, Value *argv, Value *result) {
+        Port *port = output_port(argc, argv, 0);
+
+        if (port == NULL)
+                return RETVAL_ERROR;
+        if (port_flush(port) < 0) {
+                fprintf(stderr, "skm: can't write to %s\n", port->name);
+                return RETVAL_ERROR;
+        }
+        *result = VALUE_EMPTY;
+        return RETVAL_ATOM;
+}
+
+static int prim_open_output_file(int argc, Value *argv, Value *result) {
+        Port *port;
+        char *name;
+
+        if (value_tag(argv[0]) != TAG_STRING) {
+                fprintf(stderr, "skm: wrong type of argument\n");
+                return RETVAL_ERROR;
+        }
+        name = value_get_string(argv[0]);
+        port = port_open(name);
+        if (port == NULL) {
+                fprintf(stderr, "skm: can't open %s\n", name);
+                return RETVAL_ERROR;
+        }
+        *result = value_ptr(TAG_PORT, port);
+        return RETVAL_ATOM;
+}
+
+static int prim_close_output_port(int argc, Value *argv, Value *result) {
+        Port *port = output_port(argc, argv, 0);
+
+        if (port == NULL)
+                return RETVAL_ERROR;
+        if (port_close(port) < 0) {
+                fprintf(stderr, "skm: can't write to %s\n", port->name);
+                return RETVAL_ERROR;
+        }
+        *result = VALUE_EMPTY;
+        return RETVAL_ATOM;
+}
+
+static int prim_current_output_port(int argc, Value *argv, Value *result) {
+        *result = value_ptr(TAG_PORT, port_stdout);
+        return RETVAL_ATOM;
+}
+
+/* collect now and report how it has gone so far, the
+ * result is the number of objects freed */
+static int prim_gc(int argc, Value *argv, Value *result) {
+        GcStats *st;
+        long freed;
+
+        freed = gc_collect();
+        st = gc_stats();
+        fprintf(stderr, "gc: %d collections, %ld live, %ld freed, "
+                        "pause %.3fms, max %.3fms, total %.3fms\n", 
+                        st->collections, st->live, st->freed, st->last_pause * 1e3, 
+                        st->max_pause * 1e3, st->total_pause * 1e3);
+        *result = value_fixnum(freed);
+        return RETVAL_ATOM;
+}
+
+/* The operands are only borrowed, so the new pair gets
+ * copies. A pair is never copied itself, lists share
+ * their tails the way they should */
+static int prim_cons(int argc, Value *argv, Value *result) {
+        Value car = value_copy(argv[0]), cdr = value_copy(argv[1]);
+        Pair *p = pair_new(car, cdr);
+
+        if (p == NULL) {
+                value_free(car);
+                value_free(cdr);
+                fprintf(stderr, "skm: out of memory\n");
+                return RETVAL_ERROR;
+        }
+        *result = value_ptr(TAG_PAIR, p);
+        return RETVAL_ATOM;
+}
+
+static int prim_car(int argc, Value *argv, Value *result) {
+        Pair *p = get_pair(argv[0]);
+
+        if (p == NULL)
+                return RETVAL_ERROR;
+        *result = value_copy(p->car);
+        return value_type(*result);
+}
+
+static int prim_cdr(int argc, Value *argv, Value *result) {
+        Pair *p = get_pair(argv[0]);
+
+        if (p == NULL)
+                return RETVAL_ERROR;
+        *result = value_copy(p->cdr);
+        return value_type(*result);
+}
+
+static int prim_pair(int argc, Value *argv, Value *result) {
+        *result = value_bool(value_tag(argv[0]) == TAG_PAIR);
+        return RETVAL_ATOM;
+}
+
+static int prim_null(int argc, Value *argv, Value *result) {
+        *result = value_bool(argv[0] == VALUE_NIL);
+        return RETVAL_ATOM;
+}
+
+/* built from the last operand back, the list so far
+ * is a root while the next pair is made */
+static int prim_list(int argc, Value *argv, Value *result) {
+        Value list = VALUE_NIL, car;
+        Pair *p;
+        int roots = gc_root(ROOT_VALUE, &list);
+        int i;
+
+        for (i = argc - 1; i >= 0; i--) {
+                car = value_copy(argv[i]);
+                p = pair_new(car, list);
+                if (p == NULL) {
+                        value_free(car);
+                        gc_unroot(roots);
+                        fprintf(stderr, "skm: out of memory\n");
+                        return RETVAL_ERROR;
+                }
+                list = value_ptr(TAG_PAIR, p);
+        }
+        gc_unroot(roots);
+        *result = list;
+        return RETVAL_ATOM;
+}
+
+/* v if it's a pair, NULL otherwise */
+static Pair *get_pair(Value v) {
+        if (value_tag(v) != TAG_PAIR) {
+                fprintf(stderr, "skm: wrong type of argument\n");
+                return NULL;
+        }
+        return value_get_pair(v);
+}
+
+/* argv[i] if it's there and a port that's still open, 
+ * standard output if it isn't there, NULL otherwise */
+static Port *output_port(int argc, Value *argv, int i) {
+        Port *port;
+
+        if (i >= argc)
+                return port_stdout;
+        if (value_tag(argv[i]) != TAG_PORT) {
+                fprintf(stderr, "skm: wrong type of argument\n");
+                return NULL;
+        }
+        port = value_get_port(argv[i]);
+        if (port->fd < 0) {
+                fprintf(stderr, "skm: port %s is closed\n", port->name);
+                return NULL;
+        }
+        return port;
+}
+
+/* Fold the operands with an arithmetic operator. Fixnums stay
+ * fixnums as long as the result fits, anything else is a flonum.
+ * Neither case allocates. */
+static int arith(char op, int argc, Value *argv, Value *result) {
+        Value v;
+        int64_t i = 0, j, n;
+        double f = 0;
+        int exact = 1;
+        int k = 0;
+
+        if (op == '*')
+                i = f = 1;
+        /* (- x) and (/ x) negate and invert, otherwise 
+         * fold everything into the first operand */
+        if ((op == '-' || op == '/') && argc > 1) {
+                v = argv[k++];
+                if (!value_is_num(v))
+                        goto wrongtype;
+                exact = (value_tag(v) == TAG_FIXNUM);
+                f = value_get_num(v);
+                i = (exact) ? value_get_fixnum(v) : 0;
+        } else if (op == '-' || op == '/') {
+                i = f = (op == '-') ? 0 : 1;
+        }
+        for (; k < argc; k++) {
+                v = argv[k];
+                if (!value_is_num(v))
+                        goto wrongtype;
+                if (exact && value_tag(v) == TAG_FIXNUM) {
+                        /* a 64 bit accumulator can't overflow on 
+                         * a single step with 32 bit operands */
+                        n = value_get_fixnum(v);
+                        if (op == '+')
+                                j = i + n;
+                        else if (op == '-')
+                                j = i - n;
+                        else if (op == '*')
+                                j = i * n;
+                        else if (n != 0 && i % n == 0)
+                                j = i / n;
+                        else
+                                j = INT64_MAX;
+                        if (j >= INT32_MIN && j <= INT32_MAX) {
+                                i = j;
+                                f = j;
+                                continue;
+                        }
+                        /* overflow or inexact quotient, redo with doubles */
+                }
+                exact = 0;
+                if (op == '+')
+                        f += value_get_num(v);
+                else if (op == '-')
+                        f -= value_get_num(v);
+                else if (op == '*')
+                        f *= value_get_num(v);
+                else
+                        f /= value_get_num(v);
+        }
+        *result = (exact) ? value_fixnum(i) : value_flonum(f);
+        return RETVAL_ATOM;
+wrongtype:
+        fprintf(stderr, "skm: wrong type of argument\n");
+        return RETVAL_ERROR;
+}
+
+/* Compare every operand to the one after it */
+static int compare(int op, int argc, Value *argv, Value *result) {
+        Value a, b;
+        double x, y;
+        int boolean = 1;
+        int k;
+
+        for (k = 0; k + 1 < argc && boolean; k++) {
+                a = argv[k];
+                b = argv[k + 1];
+                /* equality is defined for anything */
+                if (op == CMP_EQ) {
+                        boolean = equal(a, b);
+                        continue;
+                }
+                if (!value_is_num(a) || !value_is_num(b)) {
+                        fprintf(stderr, "skm: wrong type of argument\n");
+                        return RETVAL_ERROR;
+                }
+                x = value_get_num(a);
+                y = value_get_num(b);
+                if (op == CMP_GT)
+                        boolean = x > y;
+                else if (op == CMP_GE)
+                        boolean = x >= y;
+                else if (op == CMP_LT)
+                        boolean = x < y;
+                else
+                        boolean = x <= y;
+        }
+        *result = value_bool(boolean);
+        return RETVAL_ATOM;
+}
+
+/* numbers compare by value, strings by content and 
+ * everything else by identity */
+static int equal(Value a, Value b) {
+        if (value_is_num(a) && value_is_num(b))
+                return value_get_num(a) == value_get_num(b);
+        if (value_tag(a) == TAG_STRING && value_tag(b) == TAG_STRING)
+                return !strcmp(value_get_string(a), value_get_string(b));
+        return a == b;
+}
@@ -0,0 +1,13 @@
+/* skm - scheme interpreter
+ * author: Eugene Ma (edma2) */
+#ifndef PRIM_H
+#define PRIM_H
+#include "eval.h"
+
+/* max of a primitive that takes any number of operands */
+#define ARGS_ANY 	-1
+
+void prim_init(Env *env);
+int prim_register(Env *env, Primitive *prim);
+int apply_primitive(Lambda *prim, int argc, Value *argv, Value *result);
+#endif
@@ -0,0 +1,350 @@
+/* skm - scheme interpreter
+ * author: Eugene Ma (edma2) */
+#include <signal.h>
+#include <time.h>
+#include <sys/time.h>
+#include "prof.h"
+
+/* microseconds between samples */
+#define PROF_INTERVAL 	1000
+/* size of the arena chunks entries and nodes come from */
+#define PROF_CHUNK 	4096
+
+/* what's known about the procedures of one name, anonymous
+ * lambdas all share the entry whose name is NULL */
+typedef struct {
+	Symbol *name;
+	long calls;
+	/* seconds in its own body, and in its calls as well */
+	double self;
+	double total;
+	/* calls of it running, so recursion isn't counted
+	 * twice in total */
+	int active;
+} ProfEntry;
+
+/* One for every different stack of names there has been, the
+ * root is the top level. Samples land on the one running */
+typedef struct ProfNode ProfNode;
+struct ProfNode {
+	ProfEntry *entry;
+	ProfNode *parent;
+	ProfNode *child;
+	ProfNode *next;
+	volatile sig_atomic_t samples;
+};
+
+/* a running call */
+typedef struct {
+	ProfNode *node;
+	double start;
+	/* seconds spent in the calls it made */
+	double children;
+} ProfFrame;
+
+static ProfEntry *prof_entry(Lambda *b);
+static ProfNode *prof_node(ProfNode *parent, ProfEntry *entry);
+static void prof_push(ProfNode *parent, Lambda *b, double now);
+static void prof_pop(double now);
+static void prof_report(void);
+static int prof_compare(const void *a, const void *b);
+static void prof_fold(FILE *out, ProfNode *node);
+static void prof_fold_path(FILE *out, ProfNode *node);
+static void prof_sample(int sig);
+static void prof_timer(int on);
+static double prof_now(void);
+
+int prof_on = 0;
+char *prof_folded = NULL;
+/* (profile) forms and -P nest, the outermost one reports */
+static int level = 0;
+static double started;
+static long calls;
+/* Symbol * -> ProfEntry *, the anonymous entry is under &anonymous */
+static Hash *entries = NULL;
+static char anonymous;
+static Arena *arena = NULL;
+static ProfNode *root = NULL;
+static ProfNode *volatile running = NULL;
+static Vector *stack = NULL;
+
+/************************************************/
+/****************   Interface   *****************/
+/************************************************/
+
+/* Start recording calls from scratch, unless a profile is
+ * being taken already. Profiling that can't start is quietly
+ * skipped, the program runs the same either way */
+void prof_begin(void) {
+	if (level++ > 0)
+		return;
+	prof_free();
+	stack = vector_new(sizeof(ProfFrame));
+	entries = hash_new(0);
+	arena = arena_new(PROF_CHUNK);
+	if (stack == NULL || entries == NULL || arena == NULL)
+		return;
+	root = arena_alloc(arena, sizeof(ProfNode));
+	if (root == NULL)
+		return;
+	memset(root, 0, sizeof(ProfNode));
+	running = root;
+	calls = 0;
+	started = prof_now();
+	prof_on = 1;
+	if (prof_folded != NULL)
+		prof_timer(1);
+}
+
+/* stop once the outermost profile is over and report it */
+void prof_end(void) {
+	double now = prof_now();
+
+	if (level == 0 || --level > 0)
+		return;
+	prof_on = 0;
+	if (prof_folded != NULL)
+		prof_timer(0);
+	/* it never started */
+	if (root == NULL)
+		return;
+	/* whatever is still running ends here */
+	while (vector_size(stack) > 0)
+		prof_pop(now);
+	prof_report();
+}
+
+int prof_level(void) {
+	return level;
+}
+
+/* a call of b starts */
+void prof_enter(Lambda *b) {
+	calls++;
+	prof_push((ProfNode *)running, b, prof_now());
+}
+
+/* the running call is replaced by a call of b */
+void prof_tail(Lambda *b) {
+	double now = prof_now();
+	ProfNode *parent;
+
+	if (vector_size(stack) == 0) {
+		prof_enter(b);
+		return;
+	}
+	parent = ((ProfFrame *)vector_last(stack))->node->parent;
+	prof_pop(now);
+	calls++;
+	prof_push(parent, b, now);
+}
+
+/* the running call returns */
+void prof_exit(void) {
+	if (vector_size(stack) > 0)
+		prof_pop(prof_now());
+}
+
+/* how many calls are running, for prof_unwind */
+int prof_height(void) {
+	return (stack != NULL) ? vector_size(stack) : 0;
+}
+
+/* end the calls an error left running above height */
+void prof_unwind(int height) {
+	double now = prof_now();
+
+	while (vector_size(stack) > height)
+		prof_pop(now);
+}
+
+void prof_free(void) {
+	hash_free(entries);
+	arena_free(arena);
+	vector_free(stack);
+	stack = NULL;
+	entries = NULL;
+	arena = NULL;
+	root = running = NULL;
+}
+
+/************************************************/
+/****************   Recording   *****************/
+/************************************************/
+
+/* find the entry of b's name, or start one */
+static ProfEntry *prof_entry(Lambda *b) {
+	void *key = (b->name != NULL) ? (void *)b->name : (void *)&anonymous;
+	ProfEntry *entry = hash_get(entries, key);
+
+	if (entry != NULL)
+		return entry;
+	entry = arena_alloc(arena, sizeof(ProfEntry));
+	if (entry == NULL)
+		return NULL;
+	memset(entry, 0, sizeof(ProfEntry));
+	entry->name = b->name;
+	if (hash_put(entries, key, entry, NULL) < 0)
+		return NULL;
+	return entry;
+}
+
+/* the child of parent for a call to entry, the one found is
+ * moved to the front since calls tend to repeat */
+static ProfNode *prof_node(ProfNode *parent, ProfEntry *entry) {
+	ProfNode *node, **link;
+
+	for (link = &parent->child; (node = *link) != NULL; link = &node->next) {
+		if (node->entry == entry) {
+			*link = node->next;
+			node->next = parent->child;
+			parent->child = node;
+			return node;
+		}
+	}
+	node = arena_alloc(arena, sizeof(ProfNode));
+	if (node == NULL)
+		return NULL;
+	memset(node, 0, sizeof(ProfNode));
+	node->entry = entry;
+	node->parent = parent;
+	node->next = parent->child;
+	parent->child = node;
+	return node;
+}
+
+static void prof_push(ProfNode *parent, Lambda *b, double now) {
+	ProfEntry *entry = prof_entry(b);
+	ProfNode *node;
+	ProfFrame frame;
+
+	/* out of memory, record nothing more */
+	if (entry == NULL || (node = prof_node(parent, entry)) == NULL) {
+		prof_on = 0;
+		return;
+	}
+	frame.node = node;
+	frame.start = now;
+	frame.children = 0;
+	if (!vector_push(stack, &frame)) {
+		prof_on = 0;
+		return;
+	}
+	entry->calls++;
+	entry->active++;
+	running = node;
+}
+
+static void prof_pop(double now) {
+	ProfFrame *frame = vector_last(stack);
+	ProfEntry *entry = frame->node->entry;
+	double elapsed = now - frame->start;
+
+	entry->self += elapsed - frame->children;
+	if (--entry->active == 0)
+		entry->total += elapsed;
+	running = frame->node->parent;
+	vector_pop(stack);
+	if (vector_size(stack) > 0)
+		((ProfFrame *)vector_last(stack))->children += elapsed;
+}
+
+/************************************************/
+/****************   Reporting   *****************/
+/************************************************/
+
+/* print every entry to stderr, the most time spent in
+ * its own body first, then write the folded stacks */
+static void prof_report(void) {
+	Vector *v = hash_vector(entries);
+	ProfEntry **e;
+	FILE *out;
+	int i;
+
+	fprintf(stderr, "profile: %ld calls in %.3fms\n", calls, (prof_now() - started) * 1e3);
+	if (v != NULL) {
+		e = vector_data(v);
+		qsort(e, vector_size(v), sizeof(ProfEntry *), prof_compare);
+		fprintf(stderr, "%10s %12s %12s  %s\n", "calls", "self ms", "total ms", "procedure");
+		for (i = 0; i < vector_size(v); i++) {
+			fprintf(stderr, "%10ld %12.3f %12.3f  %s\n", e[i]->calls, e[i]->self * 1e3,
+					e[i]->total * 1e3, (e[i]->name) ? e[i]->name->name : "(lambda)");
+		}
+		vector_free(v);
+	}
+	if (prof_folded == NULL)
+		return;
+	out = fopen(prof_folded, "w");
+	if (out == NULL) {
+		fprintf(stderr, "skm: can't write %s\n", prof_folded);
+		return;
+	}
+	prof_fold(out, root);
+	fclose(out);
+}
+
+static int prof_compare(const void *a, const void *b) {
+	double x = (*(ProfEntry **)a)->self, y = (*(ProfEntry **)b)->self;
+
+	return (x < y) - (x > y);
+}
+
+/* a line for every stack that was sampled: the names from
+ * the outermost call in, then how many samples it got */
+static void prof_fold(FILE *out, ProfNode *node) {
+	ProfNode *c;
+
+	if (node->samples > 0) {
+		if (node == root)
+			fputs("(top)", out);
+		else
+			prof_fold_path(out, node);
+		fprintf(out, " %ld\n", (long)node->samples);
+	}
+	for (c = node->child; c; c = c->next)
+		prof_fold(out, c);
+}
+
+static void prof_fold_path(FILE *out, ProfNode *node) {
+	if (node->parent != root) {
+		prof_fold_path(out, node->parent);
+		fputc(';', out);
+	}
+	fputs((node->entry->name) ? node->entry->name->name : "(lambda)", out);
+}
+
+/************************************************/
+/*****************   Sampling   *****************/
+/************************************************/
+
+/* SIGPROF, whatever is running gets the sample */
+static void prof_sample(int sig) {
+	ProfNode *node = running;
+
+	if (node != NULL)
+		node->samples++;
+}
+
+static void prof_timer(int on) {
+	struct itimerval it;
+	struct sigaction sa;
+
+	memset(&it, 0, sizeof(it));
+	if (on) {
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = prof_sample;
+		sa.sa_flags = SA_RESTART;
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGPROF, &sa, NULL);
+		it.it_interval.tv_usec = PROF_INTERVAL;
+		it.it_value.tv_usec = PROF_INTERVAL;
+	}
+	setitimer(ITIMER_PROF, &it, NULL);
+}
+
+static double prof_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
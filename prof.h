@@ -0,0 +1,22 @@
+/* skm - scheme interpreter
+ * author: Eugene Ma (edma2) */
+#ifndef PROF_H
+#define PROF_H
+#include "skm.h"
+
+/* set while calls are being recorded */
+extern int prof_on;
+/* if set, the call stack is sampled and written there as
+ * folded stacks whenever a profile is reported */
+extern char *prof_folded;
+
+void prof_begin(void);
+void prof_end(void);
+int prof_level(void);
+void prof_enter(Lambda *b);
+void prof_tail(Lambda *b);
+void prof_exit(void);
+int prof_height(void);
+void prof_unwind(int height);
+void prof_free(void);
+#endif
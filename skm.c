@@ -1,21 +1,22 @@
 /* skm - scheme interpreter
  * author: Eugene Ma (edma2) */
-#include "skm.h"
+#include <time.h>
+#include "eval.h"
+#include "vm.h"
+#include "gc.h"
 
-static void env_sweep_frames_helper(Env *env);
-static void env_sweep_lambdas_helper(Env *env);
-static void bind_reset(Env *env, char *symbol);
 static void bind_free_helper(void *data);
-static void bind_print_helper(void *data);
-static int lambda_isbound(Lambda *b);
+
+/* moves on whenever a binding is replaced */
+unsigned int bind_version = 0;
 
 /************************************************/
 /*************    Environments    ***************/
 /************************************************/
 
-/* return a new environment with empty frame */
+/* return a new global environment with empty frame */
 Env *env_new(void) {
-	Frame *f = frame_new();
+	Frame *f = frame_new_indexed();
 	if (f == NULL)
 		return NULL;
 	return tree_new(f);
@@ -26,11 +27,30 @@ int env_is_global(Env *env) {
 	return env_parent(env) == NULL;
 }
 
-/* extend environment with frame */
+/* extend environment with frame, order among
+ * sibling environments doesn't matter */
 Env *env_extend(Env *env, Frame *f) {
 	if (f == NULL)
 		return NULL;
-	return tree_insert_child(env, f);
+	gc_stats()->frames++;
+	return tree_push_child(env, f);
+}
+
+/* Free a call frame when its call returns. Unless a lambda 
+ * was made in it nothing else can reach it, and a frame that
+ * doesn't have one has nothing extending it either */
+void env_release(Env *env) {
+	Frame *f;
+
+	if (env == NULL || env_is_global(env))
+		return;
+	f = env_frame(env);
+	if (f->captured || !tree_is_leaf(env))
+		return;
+	tree_detach(env);
+	frame_free(f);
+	free(env);
+	gc_forget();
 }
 
 /* return parent environment */
@@ -38,8 +58,17 @@ Env *env_parent(Env *env) {
 	return tree_parent(env);
 }
 
+/* return the outermost environment */
+Env *env_global(Env *env) {
+	if (env == NULL)
+		return NULL;
+	while (!env_is_global(env))
+		env = env_parent(env);
+	return env;
+}
+
 /* lookup a symbol */
-Bind *env_search(Env *env, char *symbol) {
+Bind *env_search(Env *env, Symbol *symbol) {
 	Bind *bind;
 
 	if (symbol == NULL)
@@ -52,57 +81,136 @@ Bind *env_search(Env *env, char *symbol) {
 	return NULL;
 }
 
-Frame *frame_new(void) {
-	Frame *f = malloc(sizeof(Frame));
+/* a call frame with one unassigned slot per name */
+Frame *frame_new(Symbol **names, int size) {
+	Frame *f;
+	int i;
+
+	gc_poll();
+	f = ds_malloc(sizeof(Frame) + size * sizeof(Bind));
+	if (f == NULL)
+		return NULL;
+	f->index = NULL;
+	f->size = size;
+	for (i = 0; i < size; i++) {
+		f->slots[i].symbol = names[i];
+		f->slots[i].value = VALUE_UNBOUND;
+	}
+	f->mark = 0;
+	f->captured = 0;
+	return f;
+}
+
+/* a frame with constant time lookup and replacement,
+ * for environments that hold a lot of bindings */
+Frame *frame_new_indexed(void) {
+	Frame *f = ds_malloc(sizeof(Frame));
 
 	if (f == NULL)
 		return NULL;
-	/* create an empty list of bindings */
-	f->bindings = list_new();
-	if (f->bindings == NULL) {
+	f->size = 0;
+	f->index = hash_new(0);
+	if (f->index == NULL) {
 		free(f);
 		return NULL;
 	}
-	/* mark the frame as unsaved */
-	f->lambda_count = 0;
+	f->mark = 0;
+	f->captured = 0;
 	return f;
 }
 
-Bind *frame_search(Frame *f, char *symbol) {
+Bind *frame_search(Frame *f, Symbol *symbol) {
+	int i;
+
 	/* return a matching Bind if found
 	 * NULL otherwise */
-	Node *ptr = list_search(f->bindings, symbol, bind_match);
-	return (ptr) ? (Bind *)ptr->data : NULL;
+	if (f->index != NULL)
+		return (Bind *)hash_get(f->index, symbol);
+	i = frame_find_slot(f, symbol);
+	return (i < 0) ? NULL : &f->slots[i];
 }
 
-int bind_match(void *bind, void *symbol) {
-	if (bind == NULL || symbol == NULL)
-		return -1;
-	/* return 0 if match is found */
-	return strcmp(((Bind *)bind)->symbol, symbol);
+/* return the slot index of symbol in a call frame, -1 if 
+ * it isn't there */
+int frame_find_slot(Frame *f, Symbol *symbol) {
+	int i;
+
+	for (i = 0; i < f->size; i++) {
+		if (f->slots[i].symbol == symbol)
+			return i;
+	}
+	return -1;
+}
+
+/* return a slot by its lexical address */
+Bind *frame_slot(Env *env, int depth, int slot) {
+	for (; depth > 0; depth--)
+		env = env_parent(env);
+	return &env_frame(env)->slots[slot];
+}
+
+/* return a new vector of every assigned Bind * in the 
+ * frame, which stays valid while the frame is modified */
+Vector *frame_bindings(Frame *f) {
+	Vector *v;
+	Bind *bind;
+	int i;
+
+	if (f->index != NULL)
+		return hash_vector(f->index);
+	v = vector_new(sizeof(Bind *));
+	if (v == NULL)
+		return NULL;
+	for (i = 0; i < f->size; i++) {
+		bind = &f->slots[i];
+		if (bind->value != VALUE_UNBOUND && !vector_push(v, &bind)) {
+			vector_free(v);
+			return NULL;
+		}
+	}
+	return v;
 }
 
 /* Call this after we create a binding, and add it to
- * the environment */
+ * the environment. Call frames can't grow, so the symbol
+ * has to be one of their slots */
 Bind *bind_add(Env *env, Bind *new) {
-	Bind *old;
+	void *old;
+	Bind *slot;
 	Frame *f;
 
 	if (env == NULL || new == NULL)
 		return NULL;
 	f = env_frame(env);
-	/* check for existing binding in current frame only */
-	if ((old = frame_search(f, new->symbol)))
-		bind_remove(f, old);
-	return (Bind *)list_append(f->bindings, new);
+	if (f->index != NULL) {
+		/* replace in place */
+		if (hash_put(f->index, new->symbol, new, &old) < 0)
+			return NULL;
+		if (old != NULL) {
+			/* whoever cached the old one has to look again */
+			bind_version++;
+			bind_free((Bind *)old);
+		}
+		return new;
+	}
+	slot = frame_search(f, new->symbol);
+	if (slot == NULL) {
+		fprintf(stderr, "skm: can't define %s here\n", new->symbol->name);
+		return NULL;
+	}
+	/* move the value over */
+	value_free(slot->value);
+	slot->value = new->value;
+	free(new);
+	return slot;
 }
 
-/* Remove binding from frame and call bind_free */
-void bind_remove(Frame *f, Bind *bind) {
-	/* remove old binding from list 
-	 * and free the bind data struct */
-	list_remove(f->bindings, bind);
-	bind_free(bind);
+/* Store a value in an existing binding */
+void bind_set(Bind *bind, Value value) {
+	Value old = bind->value;
+
+	bind->value = value_copy(value);
+	value_free(old);
 }
 
 /* Return the top-most frame of the environment */
@@ -112,28 +220,18 @@ Frame *env_frame(Env *env) {
 	return (Frame *)env->data;
 }
 
-/* Create a new binding given a pointer to a lambda
- * or a string, coupled with a symbol and value type */
-Bind *bind_new(char *symbol, void *value, int type) {
-	Bind *bind = malloc(sizeof(Bind));
+/* Create a new binding given a symbol and a value,
+ * the binding takes its own copy of the value */
+Bind *bind_new(Symbol *symbol, Value value) {
+	Bind *bind;
 
+	if (symbol == NULL)
+		return NULL;
+	bind = ds_malloc(sizeof(Bind));
 	if (bind == NULL)
 		return NULL;
-	strncpy(bind->symbol, symbol, SYMBOL_MAX);
-	if (type == RETVAL_LAMBDA) {
-		/* if the value we're trying to bind to is
-		 * a lambda, we should increase the counter 
-		 * field of the lambda structure */
-		((Lambda *)value)->bind_count++;
-		/* we should also increase the frame counter */
-		env_frame(((Lambda *)value)->env)->lambda_count++;
-	} else if (type == RETVAL_ATOM) {
-		/* or else we should just allocate a new string
-		 * in memory */
-		value = strdup((char *)value);
-	}
-	bind->value = value;
-	bind->type = type;
+	bind->symbol = symbol;
+	bind->value = value_copy(value);
 	return bind;
 }
 
@@ -141,143 +239,168 @@ Bind *bind_new(char *symbol, void *value, int type) {
 /****************   Lambda   ********************/
 /************************************************/
 
-/* Returns BOUND_LAMBDA if lambda should stick around in memory */
-static int lambda_isbound(Lambda *b) {
-	if (b == NULL)
-		return -1;
-	/* check if lambda is unbound */
-	return (b->bind_count) ? BOUND_LAMBDA : UNBOUND_LAMBDA;
-}
-
-/* Create a new lambda given its parameters and body
- * expression, connect it to the given environment */
-Lambda *lambda_new(Env *env, Expr *body, Expr *param) {
+/* Create a new lambda that runs the code of proto, 
+ * connect it to the given environment */
+Lambda *lambda_new(Env *env, Proto *proto) {
 	Lambda *b;
 
-        b = malloc(sizeof(Lambda));
+	gc_poll();
+        b = ds_malloc(sizeof(Lambda));
 	if (b == NULL)
 		return NULL;
-	/* non-primitive procedure */
-	if (body != NULL) {
-		/* copy expressions */
-		body = expr_copy(body);
-		param = expr_copy(param);
-		if (body == NULL || param == NULL) {
-			lambda_free(b);
-			return NULL;
-		}
-	} 
-	/* all ready */
-	b->body = body;
-	b->param = param;
+	gc_stats()->lambdas++;
 	b->env = env;
-	b->bind_count = 0;
+	env_frame(env)->captured = 1;
+	b->proto = proto;
+	b->name = NULL;
+	b->body = NULL;
+	b->param = NULL;
+	b->names = NULL;
+	b->nparams = 0;
+	b->nslots = 0;
+	/* the code is shared, not copied */
+	if (proto != NULL) {
+		proto->refs++;
+		b->body = proto->body;
+		b->param = proto->param;
+		b->names = proto->names;
+		b->nparams = proto->nparams;
+		b->nslots = proto->nslots;
+	}
+	b->code = NULL;
+	b->prim = NULL;
+	gc_track(b);
 	return b;
 }
 
 void lambda_free(Lambda *b) {
 	/* free all memory except for environment */
-	expr_free(b->body);
-	expr_free(b->param);
+	proto_release(b->proto);
+	code_release(b->code);
 	free(b);
 }
 
+/* if v is a lambda nobody has named yet, it's called name
+ * from now on, so the profiler can say who's who */
+void lambda_name(Value v, Symbol *name) {
+	Lambda *b;
+
+	if (value_tag(v) != TAG_LAMBDA)
+		return;
+	b = value_get_lambda(v);
+	if (b->name == NULL)
+		b->name = name;
+}
+
 /************************************************/
-/************* Garbage Collection ***************/
+/****************   Values   ********************/
 /************************************************/
 
-/* the intent of this function is to 
-   free lambdas that are present in the environment */
-static void bind_reset(Env *env, char *symbol) {
-        Bind *zero;
+/* box a double, folding every NaN into the canonical
+ * quiet NaN so it can't be mistaken for a tagged value */
+Value value_flonum(double d) {
+	Value v;
 
-        zero = bind_new(symbol, "0", RETVAL_ATOM);
-        if (zero == NULL)
-                return;
-        bind_add(env, zero);
+	if (d != d)
+		return 0x7ff8000000000000ULL;
+	memcpy(&v, &d, sizeof(v));
+	return v;
 }
 
-/* free a lambda if unbound */
-void lambda_check_remove(Lambda *b) {
-        if (b == NULL)
-                return;
-        if (lambda_isbound(b) == UNBOUND_LAMBDA)
-                lambda_free(b);
+/* return a fixnum if the number is integral and fits,
+ * a flonum otherwise */
+Value value_num(double d) {
+	if (d >= INT32_MIN && d <= INT32_MAX && d == (int32_t)d)
+		return value_fixnum((int32_t)d);
+	return value_flonum(d);
 }
 
-/* set every binding to an arbitrary string: this
-   removes all lambdas and frames */
-void env_sweep_lambdas(Env *env) {
-        tree_traverse(env, env_sweep_lambdas_helper);
+/* return the numeric value of a fixnum or flonum */
+double value_get_num(Value v) {
+	double d;
+
+	if (value_tag(v) == TAG_FIXNUM)
+		return value_get_fixnum(v);
+	memcpy(&d, &v, sizeof(d));
+	return d;
 }
 
-/* tree traversal helper function */
-static void env_sweep_lambdas_helper(Env *env) {
-        Node *p;
-        Frame *f = env_frame(env);
-        List *garbage = list_new();
+/* strings are the only values that own heap memory,
+ * apart from what the collector looks after */
+Value value_string(char *s) {
+	s = ds_strdup(s);
+	if (s == NULL)
+		return VALUE_EMPTY;
+	return value_ptr(TAG_STRING, s);
+}
 
-        /* collect all the lambda symbols */
-        for (p = list_first(f->bindings); p; p = p->next) {
-                if (((Bind *)p->data)->type == RETVAL_LAMBDA)
-                        list_append(garbage, (char *)((Bind *)p->data)->symbol);
-        }
-        /* for each symbol make a meaningless binding 
-           freeing lambdas in the process */
-        for (p = list_first(garbage); p; p = p->next)
-                bind_reset(env, (char *)p->data);
-        list_free(garbage);
+Value value_copy(Value v) {
+	if (value_tag(v) == TAG_STRING)
+		return value_string(value_get_string(v));
+	return v;
 }
 
-/* free all frames without save marker */
-void env_sweep_frames(Env *env) {
-	tree_traverse(env, env_sweep_frames_helper);
+/* release a temporary value, lambdas and pairs
+ * are left to the collector */
+void value_free(Value v) {
+	if (value_tag(v) == TAG_STRING)
+		free(value_get_string(v));
 }
 
-/* tree traversal helper function */
-static void env_sweep_frames_helper(Env *env) {
-	/* don't free the global environment either */
-	if (env_is_global(env))
-		return;
-	/* if frame has at least one lambda that is 
-	 * associated with it, don't free it! */
-	if (env_frame(env)->lambda_count > 0)
-		return;
-	frame_free(env_frame(env));
-	tree_free(env);
+void value_print(Port *port, Value v) {
+	switch (value_tag(v)) {
+	case TAG_FLONUM:
+		port_printf(port, "%.15g", value_get_num(v));
+		break;
+	case TAG_FIXNUM:
+		port_printf(port, "%d", value_get_fixnum(v));
+		break;
+	case TAG_BOOL:
+		port_puts(port, (v == VALUE_TRUE) ? "#t" : "#f");
+		break;
+	case TAG_STRING:
+		port_puts(port, value_get_string(v));
+		break;
+	case TAG_LAMBDA:
+		lambda_print(port, value_get_lambda(v));
+		break;
+	case TAG_PORT:
+		port_printf(port, "[#port %s]", value_get_port(v)->name);
+		break;
+	case TAG_PAIR:
+		pair_print(port, value_get_pair(v));
+		break;
+	case TAG_EMPTY:
+		if (v == VALUE_NIL)
+			port_puts(port, "()");
+		break;
+	}
 }
 
-/* Remove a bind and check both lambda and frame 
- * for garbage collection by modifying and examining
- * the count */
-void bind_free(Bind *bind) {
-	Lambda *b;
+/************************************************/
+/**************** Freeing Memory ****************/
+/************************************************/
 
+/* Remove a bind and the value it owns */
+void bind_free(Bind *bind) {
 	if (bind == NULL)
 		return;
-	if (bind->type == RETVAL_LAMBDA) {
-		/* if we try to free a binding whose
-		 * value points to a lambda we should 
-		 * either decrease the count of the lambda
-		 * or free it if this count becomes 0 */
-		b = (Lambda *)bind->value;
-		b->bind_count--;
-                env_frame(b->env)->lambda_count--;
-		if (lambda_isbound(b) == UNBOUND_LAMBDA)
-			lambda_free(b);
-	} else {
-		/* free the allocated string in memory */
-		free(bind->value);
-	}
+	value_free(bind->value);
 	free(bind);
 }
 
 void frame_free(Frame *f) {
+	int i;
+
 	if (f == NULL)
 		return;
 	/* free all bindings */
-	list_traverse(f->bindings, bind_free_helper);
-	list_free(f->bindings);
+	if (f->index != NULL) {
+		hash_traverse(f->index, bind_free_helper);
+		hash_free(f->index);
+	}
+	for (i = 0; i < f->size; i++)
+		value_free(f->slots[i].value);
 	free(f);
 }
 
@@ -288,6 +411,41 @@ static void bind_free_helper(void *data) {
 	bind_free((Bind *)data);
 }
 
+/************************************************/
+/*****************   Usage   ********************/
+/************************************************/
+
+static double seconds(clockid_t clock) {
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* what the process has used so far */
+void usage_get(Usage *u) {
+	GcStats *st = gc_stats();
+
+	u->wall = seconds(CLOCK_MONOTONIC);
+	u->cpu = seconds(CLOCK_PROCESS_CPUTIME_ID);
+	u->allocs = ds_allocs;
+	u->bytes = ds_alloc_bytes;
+	u->frames = st->frames;
+	u->lambdas = st->lambdas;
+}
+
+/* print to stderr what's been used since start */
+void usage_report(Usage *start) {
+	Usage now;
+
+	usage_get(&now);
+	fprintf(stderr, "time: %.3fms wall, %.3fms cpu, %ld allocs, %ld bytes, "
+			"%ld frames, %ld closures\n",
+			(now.wall - start->wall) * 1e3, (now.cpu - start->cpu) * 1e3,
+			now.allocs - start->allocs, now.bytes - start->bytes,
+			now.frames - start->frames, now.lambdas - start->lambdas);
+}
+
 /************************************************/
 /************* Debugging Utilities **************/
 /************************************************/
@@ -299,37 +457,52 @@ void env_print(Env *env) {
 
 /* print the top level frame of the environment */
 void frame_print(Env *env) {
-	printf("lambda count: %d\n", env_frame(env)->lambda_count);
-	printf("-----------------------------\n");
-	if (!list_size(env_frame(env)->bindings))
-		printf("[empty]\n");
-	else
-		list_traverse(env_frame(env)->bindings, bind_print_helper);
-	printf("-----------------------------\n\n");
-}
-
-static void bind_print_helper(void *data) {
-	/* this helper function casts the void pointer
-	 * to a Bind so we can pass it to list traverse */
-	bind_print((Bind *)data);
+	Vector *bindings = frame_bindings(env_frame(env));
+	int i;
+
+	port_puts(port_stdout, "-----------------------------\n");
+	if (vector_size(bindings) <= 0)
+		port_puts(port_stdout, "[empty]\n");
+	for (i = 0; i < vector_size(bindings); i++)
+		bind_print(*(Bind **)vector_at(bindings, i));
+	vector_free(bindings);
+	port_puts(port_stdout, "-----------------------------\n\n");
 }
 
 void bind_print(Bind *bind) {
 	/* print some useful information about a binding */
 	if (bind == NULL)
 		return;
-	if (bind->type != RETVAL_LAMBDA) {
-		printf("[%s -> %s]\n", bind->symbol, (char *)bind->value);
-	} else {
-		printf("[%s -> ", bind->symbol);
-		lambda_print((Lambda *)bind->value);
+	port_printf(port_stdout, "[%s -> ", bind->symbol->name);
+	value_print(port_stdout, bind->value);
+	port_puts(port_stdout, "]\n");
+}
+
+/* a list prints as (a b c), and if it doesn't end in ()
+ * the last cdr comes after a dot */
+void pair_print(Port *port, Pair *p) {
+	Value v;
+
+	port_write(port, "(", 1);
+	for (;;) {
+		value_print(port, p->car);
+		v = p->cdr;
+		if (value_tag(v) != TAG_PAIR)
+			break;
+		port_write(port, " ", 1);
+		p = value_get_pair(v);
+	}
+	if (v != VALUE_NIL) {
+		port_write(port, " . ", 3);
+		value_print(port, v);
 	}
+	port_write(port, ")", 1);
 }
 
-void lambda_print(Lambda *b) {
-	/* print the number of symbols binded to this 
+void lambda_print(Port *port, Lambda *b) {
+	/* print the number of parameters of this 
 	 * lambda and its address in memory */
-	printf("[#proc %d (%p)]", b->bind_count, b);
+	port_printf(port, "[#proc %d (%p)]", b->nparams, b);
 //        tree_print(b->param);
 //        tree_print(b->body);
 }
@@ -1,63 +1,197 @@
 /* skm - scheme interpreter
  * author: Eugene Ma (edma2) */
 
-/* TODO: 
- * Support empty lists e.g. () 
- */
-
+#ifndef SKM_H
+#define SKM_H
+#include <stdint.h>
 #include "parser.h"
+#include "port.h"
 #ifndef DS_H
 #define DS_H
 #include "ds/ds.h"
 #endif
 
-#define SYMBOL_MAX 	30
-#define UNBOUND_LAMBDA 	0
-#define BOUND_LAMBDA 	1
 #define RETVAL_ATOM 	0
 #define RETVAL_LAMBDA 	2
 #define RETVAL_ERROR 	-1
 
+/* Values are NaN-boxed: a flonum is stored as the double itself,
+ * everything else lives in the payload of a negative signalling NaN,
+ * which arithmetic never produces. Fixnums, booleans, the empty value
+ * and the empty list are immediates, strings, lambdas, ports and pairs
+ * are tagged pointers. */
+typedef uint64_t Value;
+
+#define TAG_FLONUM 	0
+#define TAG_FIXNUM 	1
+#define TAG_BOOL 	2
+#define TAG_EMPTY 	3
+#define TAG_STRING 	4
+#define TAG_LAMBDA 	5
+#define TAG_PORT 	6
+#define TAG_PAIR 	7
+#define VALUE_PAYLOAD 	0x0000ffffffffffffULL
+
+#define value_is_boxed(v) 	((uint64_t)(((v) >> 48) - 0xfff1) < 7)
+#define value_tag(v) 		(value_is_boxed(v) ? (int)(((v) >> 48) & 0x7) : TAG_FLONUM)
+#define value_box(tag, p) 	(((uint64_t)(0xfff0 | (tag)) << 48) | ((uint64_t)(p) & VALUE_PAYLOAD))
+#define value_fixnum(i) 	value_box(TAG_FIXNUM, (uint32_t)(i))
+#define value_get_fixnum(v) 	((int32_t)(uint32_t)(v))
+#define value_bool(b) 		value_box(TAG_BOOL, (b) != 0)
+#define value_ptr(tag, p) 	value_box(tag, (uintptr_t)(p))
+#define value_get_ptr(v) 	((void *)(uintptr_t)((v) & VALUE_PAYLOAD))
+#define value_get_string(v) 	((char *)value_get_ptr(v))
+#define value_get_lambda(v) 	((Lambda *)value_get_ptr(v))
+#define value_get_port(v) 	((Port *)value_get_ptr(v))
+#define value_get_pair(v) 	((Pair *)value_get_ptr(v))
+#define value_is_num(v) 	(value_tag(v) <= TAG_FIXNUM)
+#define value_type(v) 		(value_tag(v) == TAG_LAMBDA ? RETVAL_LAMBDA : RETVAL_ATOM)
+#define VALUE_TRUE 		value_bool(1)
+#define VALUE_FALSE 		value_bool(0)
+#define VALUE_EMPTY 		value_box(TAG_EMPTY, 0)
+/* held by slots that are defined but not assigned yet */
+#define VALUE_UNBOUND 		value_box(TAG_EMPTY, 1)
+/* () */
+#define VALUE_NIL 		value_box(TAG_EMPTY, 2)
+
 typedef struct Tree Env;	
+typedef struct Code Code;
+typedef struct Proto Proto;
+typedef struct Bind {
+	Symbol *symbol;
+	Value value;
+} Bind;
+/* Where a reference to a global found its binding. A binding is
+ * only freed when bind_add replaces it, which moves bind_version
+ * on, so what's cached is good while the version still matches */
+typedef struct {
+	Bind *bind;
+	unsigned int version;
+} BindCache;
+/* the global frame indexes its bindings by symbol, a call
+ * frame is a fixed array of slots laid out by its lambda */
 typedef struct {
-	List *bindings;
-	int lambda_count;
+	Hash *index;
+	/* set while the collector finds it reachable */
+	int mark;
+	/* set once a lambda is made in it, after which only
+	 * the collector can tell when it's garbage */
+	int captured;
+	int size;
+	Bind slots[];
 } Frame;
+/* a procedure written in C, argv is only borrowed */
+typedef int (*PrimFn)(int argc, Value *argv, Value *result);
+typedef struct Primitive {
+	char *name;
+	PrimFn fn;
+	/* fewest and most operands it takes */
+	int min;
+	int max;
+	/* no side effects, so a call on literals can be
+	 * worked out before the program runs */
+	int pure;
+} Primitive;
+/* what the process had used at some point, (time)
+ * reports the difference between two of these */
 typedef struct {
-	char symbol[SYMBOL_MAX];
-	void *value;
-	int type;
-} Bind;
+	double wall;
+	double cpu;
+	long allocs;
+	long bytes;
+	long frames;
+	long lambdas;
+} Usage;
+/* a cons cell, which owns its car and cdr like a binding owns
+ * its value. Pairs are shared rather than copied and left to
+ * the collector, like lambdas */
 typedef struct {
+	Value car;
+	Value cdr;
+} Pair;
+typedef struct Lambda Lambda;
+struct Lambda {
 	Env *env;
  	Expr *body;
 	Expr *param;
-	int bind_count;
-} Lambda;
+	/* frame layout: parameters, then internal defines */
+	Symbol **names;
+	int nparams;
+	int nslots;
+	/* where the above come from, shared with other closures */
+	Proto *proto;
+	/* set if the lambda was compiled for the vm */
+	Code *code;
+	/* set if the lambda is a primitive */
+	Primitive *prim;
+	/* what it was first defined as, NULL if it never was */
+	Symbol *name;
+	/* every lambda is on the collector's list */
+	int mark;
+	Lambda *next;
+};
 
 Env *env_new(void);
 Env *env_extend(Env *env, Frame *f);
 Env *env_parent(Env *env);
+Env *env_global(Env *env);
 Frame *env_frame(Env *env);
-Bind *env_search(Env *env, char *symbol);
+Bind *env_search(Env *env, Symbol *symbol);
 void env_print(Env *env);
-void env_sweep_frames(Env *env);
-void env_sweep_lambdas(Env *env);
 int env_is_global(Env *env);
+void env_release(Env *env);
 
-Frame *frame_new(void);
-Bind *frame_search(Frame *f, char *symbol);
+Frame *frame_new(Symbol **names, int size);
+Frame *frame_new_indexed(void);
+Vector *frame_bindings(Frame *f);
+Bind *frame_search(Frame *f, Symbol *symbol);
+Bind *frame_slot(Env *env, int depth, int slot);
+int frame_find_slot(Frame *f, Symbol *symbol);
 void frame_free(Frame *f);
 void frame_print(Env *env);
 
-Bind *bind_new(char *symbol, void *value, int type);
+Bind *bind_new(Symbol *symbol, Value value);
 Bind *bind_add(Env *env, Bind *bind);
-void bind_remove(Frame *f, Bind *bind);
+void bind_set(Bind *bind, Value value);
 void bind_print(Bind *bind);
 void bind_free(Bind *bind);
-int bind_match(void *bind, void *symbol);
 
-Lambda *lambda_new(Env *env, Expr *body, Expr *params);
-void lambda_check_remove(Lambda *b);
-void lambda_print(Lambda *b);
+extern unsigned int bind_version;
+
+/* the binding of symbol in the global frame f, looked up
+ * only if *bind isn't known to be current */
+static inline Bind *bind_cached(Frame *f, Symbol *symbol, Bind **bind, unsigned int *version) {
+	if (*bind == NULL || *version != bind_version) {
+		*bind = frame_search(f, symbol);
+		*version = bind_version;
+	}
+	return *bind;
+}
+
+Lambda *lambda_new(Env *env, Proto *proto);
+void lambda_print(Port *port, Lambda *b);
 void lambda_free(Lambda *b);
+void lambda_name(Value v, Symbol *name);
+
+/* non-zero if v is a procedure that runs prim */
+static inline int calls_prim(Value v, Primitive *prim) {
+	return (value_tag(v) == TAG_LAMBDA && value_get_lambda(v)->prim == prim);
+}
+
+Pair *pair_new(Value car, Value cdr);
+int pair_mark(Pair *p);
+long pair_sweep(void);
+void pair_free_all(void);
+void pair_print(Port *port, Pair *p);
+
+void usage_get(Usage *u);
+void usage_report(Usage *start);
+
+Value value_flonum(double d);
+Value value_num(double d);
+Value value_string(char *s);
+Value value_copy(Value v);
+double value_get_num(Value v);
+void value_free(Value v);
+void value_print(Port *port, Value v);
+#endif
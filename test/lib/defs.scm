@@ -0,0 +1,2 @@
+(define loaded 42)
+(define twice (lambda (x) (* 2 x)))
@@ -0,0 +1,4 @@
+(define f (lambda (x) (load "test/lib/defs.scm")))
+(f 1)
+(display (twice loaded))
+(newline)
@@ -0,0 +1,37 @@
+(display (if #t 1 2))
+(display (if #f 1 2))
+(if #f (display 3))
+(newline)
+(define h (lambda (x) (if #t (if #f 0 (+ x (* 2 3))) 9)))
+(display (h 1))
+(newline)
+(display (+ 1 (* 2 (- 5 3)) (- 10 (* 2 2))))
+(define k (lambda () (* (+ 1 2) (- 7 (+ 1 1)))))
+(display (k))
+(newline)
+(display (cond (- 5)))
+(newline)
+(display (cond ((< 1 2) (+ 7)) (else 0)))
+(newline)
+(define f (lambda () (+ 1 (* 2 3))))
+(define g (lambda (x) (if (< 1 2) (+ x (* 2 3)) 0)))
+(display (f))
+(display (g 1))
+(newline)
+(define plus +)
+(define + -)
+(display (f))
+(display (g 1))
+(newline)
+(define < >)
+(display (g 1))
+(newline)
+(define + plus)
+(display (f))
+(define times *)
+(define * +)
+(display (f))
+(display (k))
+(define * times)
+(display (f))
+(newline)
@@ -0,0 +1,899 @@
+/* skm - scheme interpreter
+ * author: Eugene Ma (edma2) */
+#include "eval.h"
+#include "prim.h"
+#include "gc.h"
+#include "vm.h"
+#include "prof.h"
+
+#define STACK_MAX 	(1 << 16)
+#define CALLS_MAX 	(1 << 16)
+/* deepest (time) forms can nest */
+#define TIMERS_MAX 	64
+
+/* names visible to the code being compiled, innermost first */
+typedef struct Scope Scope;
+struct Scope {
+	Symbol **names;
+	int size;
+	Scope *outer;
+};
+
+typedef struct {
+	Code *code;
+	Scope *scope;
+	/* free variables are global rather than searched for */
+	int global;
+	int depth;
+} Compiler;
+
+/* a running lambda, base points just above its procedure */
+typedef struct {
+	Code *code;
+	int *pc;
+	Env *env;
+	Value *base;
+} Activation;
+
+static Code *code_new(void);
+static int grow(void **array, int *max, int n, size_t size);
+static int emit(Compiler *c, int op, int effect);
+static int add_const(Compiler *c, Value v);
+static int add_sym(Compiler *c, Symbol *sym);
+static int add_cache(Compiler *c);
+static int compile_expr(Compiler *c, Expr *expr, int tail);
+static int compile_atom(Compiler *c, Expr *expr);
+static int compile_ref(Compiler *c, Symbol *sym);
+static int compile_define(Compiler *c, Expr *expr);
+static int compile_lambda(Compiler *c, Expr *expr);
+static int compile_if(Compiler *c, Expr *expr, int tail);
+static int compile_cond(Compiler *c, Expr *expr, int tail);
+static int compile_begin(Compiler *c, Expr *expr, int tail);
+static int compile_call(Compiler *c, Expr *expr, int tail);
+static int compile_time(Compiler *c, Expr *expr);
+static int compile_profile(Compiler *c, Expr *expr);
+static int compile_quote(Compiler *c, Expr *expr);
+static int compile_fold(Compiler *c, Expr *expr, int tail);
+static int add_folds(Compiler *c, Expr *expr, int first);
+
+static Value stack[STACK_MAX];
+static Value *vm_sp = stack;
+static Activation calls[CALLS_MAX];
+static Activation *vm_fp = calls;
+/* when each running (time) started */
+static Usage timers[TIMERS_MAX];
+static int ntimers = 0;
+
+/* only strings need copying when values move around */
+#define COPY(v) 	(value_tag(v) == TAG_STRING ? value_copy(v) : (v))
+#define DROP(v) 	do { if (value_tag(v) == TAG_STRING) value_free(v); } while (0)
+
+/************************************************/
+/****************   Compiler   ******************/
+/************************************************/
+
+/* compile a top level expression to be run in env */
+Code *compile(Env *env, Expr *expr) {
+	Compiler c;
+
+	c.code = code_new();
+	if (c.code == NULL)
+		return NULL;
+	c.scope = NULL;
+	c.global = env_is_global(env);
+	c.depth = 0;
+	/* nothing to reuse at the top level, so no tail calls */
+	if (compile_expr(&c, expr, 0) < 0 || emit(&c, OP_RETURN, -1) < 0) {
+		code_release(c.code);
+		return NULL;
+	}
+	return c.code;
+}
+
+/* compile and run */
+int vm_eval(Env *env, Expr *expr, Value *result) {
+	Code *code;
+	int retval;
+
+	code = compile(env, expr);
+	if (code == NULL)
+		return RETVAL_ERROR;
+	retval = vm_run(code, env, result);
+	code_release(code);
+	return retval;
+}
+
+static Code *code_new(void) {
+	Code *code = ds_calloc(1, sizeof(Code));
+
+	if (code == NULL)
+		return NULL;
+	code->refs = 1;
+	return code;
+}
+
+void code_release(Code *code) {
+	int i;
+
+	if (code == NULL || --code->refs > 0)
+		return;
+	for (i = 0; i < code->nconsts; i++)
+		value_free(code->consts[i]);
+	for (i = 0; i < code->nquotes; i++)
+		expr_free(code->quotes[i]);
+	for (i = 0; i < code->nprotos; i++)
+		code_release(code->protos[i]);
+	free(code->ops);
+	free(code->consts);
+	free(code->syms);
+	free(code->caches);
+	free(code->folds);
+	free(code->quotes);
+	free(code->protos);
+	free(code->names);
+	free(code);
+}
+
+/* make room for element n of a growable array */
+static int grow(void **array, int *max, int n, size_t size) {
+	void *p;
+	int newmax;
+
+	if (n < *max)
+		return 0;
+	newmax = (*max) ? *max * 2 : 16;
+	p = ds_realloc(*array, newmax * size);
+	if (p == NULL)
+		return -1;
+	*array = p;
+	*max = newmax;
+	return 0;
+}
+
+/* append one word of code, effect is what it does to the stack depth */
+static int emit(Compiler *c, int op, int effect) {
+	Code *code = c->code;
+
+	if (grow((void **)&code->ops, &code->opsmax, code->nops, sizeof(int)) < 0)
+		return -1;
+	code->ops[code->nops++] = op;
+	c->depth += effect;
+	if (c->depth > code->maxstack)
+		code->maxstack = c->depth;
+	return 0;
+}
+
+/* return the index of a new constant, the pool owns it */
+static int add_const(Compiler *c, Value v) {
+	Code *code = c->code;
+
+	if (grow((void **)&code->consts, &code->constsmax, code->nconsts, sizeof(Value)) < 0) {
+		value_free(v);
+		return -1;
+	}
+	code->consts[code->nconsts] = v;
+	return code->nconsts++;
+}
+
+static int add_sym(Compiler *c, Symbol *sym) {
+	Code *code = c->code;
+	int i;
+
+	for (i = 0; i < code->nsyms; i++) {
+		if (code->syms[i] == sym)
+			return i;
+	}
+	if (grow((void **)&code->syms, &code->symsmax, code->nsyms, sizeof(Symbol *)) < 0)
+		return -1;
+	code->syms[code->nsyms] = sym;
+	return code->nsyms++;
+}
+
+/* return the index of an empty cache for a global reference */
+static int add_cache(Compiler *c) {
+	Code *code = c->code;
+
+	if (grow((void **)&code->caches, &code->cachesmax, code->ncaches, sizeof(BindCache)) < 0)
+		return -1;
+	code->caches[code->ncaches].bind = NULL;
+	code->caches[code->ncaches].version = 0;
+	return code->ncaches++;
+}
+
+/* leave the value of expr on the stack. In tail position the
+ * value is returned straight away */
+static int compile_expr(Compiler *c, Expr *expr, int tail) {
+	int retval;
+
+	if (expr == NULL)
+		return -1;
+	if (is_atom(expr)) {
+		retval = compile_atom(c, expr);
+	} else if (is_emptylist(expr)) {
+		retval = add_const(c, VALUE_NIL);
+		if (retval >= 0 && emit(c, OP_CONST, 1) == 0)
+			retval = emit(c, retval, 0);
+	} else if (is_quote(expr)) {
+		retval = compile_quote(c, expr);
+	} else if (is_define(expr)) {
+		retval = compile_define(c, expr);
+	} else if (is_lambda(expr)) {
+		retval = compile_lambda(c, expr);
+	} else if (is_if(expr)) {
+		return compile_if(c, expr, tail);
+	} else if (is_cond(expr)) {
+		return compile_cond(c, expr, tail);
+	} else if (is_begin(expr)) {
+		return compile_begin(c, expr, tail);
+	} else if (is_load(expr)) {
+		retval = compile_expr(c, expr_next(expr_child(expr)), 0);
+		if (retval == 0)
+			retval = emit(c, OP_LOAD, 0);
+	} else if (is_time(expr)) {
+		retval = compile_time(c, expr);
+	} else if (is_profile(expr)) {
+		retval = compile_profile(c, expr);
+	} else if (expr_form(expr) == FORM_FOLDED) {
+		return compile_fold(c, expr, tail);
+	} else {
+		return compile_call(c, expr, tail);
+	}
+	if (retval == 0 && tail)
+		retval = emit(c, OP_RETURN, -1);
+	return retval;
+}
+
+/* literals become constants, anything else is a reference */
+static int compile_atom(Compiler *c, Expr *expr) {
+	Value v;
+	int k;
+
+	if (expr_kind(expr) == EXPR_NUM || expr_kind(expr) == EXPR_BOOL)
+		v = expr_get_value(expr);
+	else if (expr_kind(expr) == EXPR_STRING)
+		v = value_string(expr_get_word(expr) + 1);
+	else
+		return compile_ref(c, expr_get_symbol(expr));
+	if ((k = add_const(c, v)) < 0)
+		return -1;
+	if (emit(c, OP_CONST, 1) < 0 || emit(c, k, 0) < 0)
+		return -1;
+	return 0;
+}
+
+/* resolve a variable against the enclosing lambdas */
+static int compile_ref(Compiler *c, Symbol *sym) {
+	Scope *s;
+	int depth, i, k;
+
+	for (s = c->scope, depth = 0; s; s = s->outer, depth++) {
+		for (i = 0; i < s->size; i++) {
+			if (s->names[i] == sym) {
+				if (emit(c, OP_LOCAL, 1) < 0 || emit(c, depth, 0) < 0)
+					return -1;
+				return emit(c, i, 0);
+			}
+		}
+	}
+	if ((k = add_sym(c, sym)) < 0)
+		return -1;
+	if (!c->global) {
+		if (emit(c, OP_LOOKUP, 1) < 0)
+			return -1;
+		return emit(c, k, 0);
+	}
+	if ((i = add_cache(c)) < 0)
+		return -1;
+	if (emit(c, OP_GLOBAL, 1) < 0 || emit(c, k, 0) < 0)
+		return -1;
+	return emit(c, i, 0);
+}
+
+static int compile_define(Compiler *c, Expr *expr) {
+	Expr *target = expr_next(expr_child(expr));
+	Symbol *sym;
+	int i, k;
+
+	sym = expr_get_symbol(target);
+	if (sym == NULL)
+		return -1;
+	if (compile_expr(c, expr_next(target), 0) < 0)
+		return -1;
+	/* internal defines have a slot in this frame */
+	if (c->scope != NULL) {
+		for (i = 0; i < c->scope->size; i++) {
+			if (c->scope->names[i] == sym) {
+				if (emit(c, OP_DEFLOCAL, 0) < 0)
+					return -1;
+				return emit(c, i, 0);
+			}
+		}
+	}
+	if ((k = add_sym(c, sym)) < 0)
+		return -1;
+	if (emit(c, OP_DEFINE, 0) < 0)
+		return -1;
+	return emit(c, k, 0);
+}
+
+/* compile the body into its own code, the lambda itself is
+ * created at run time by closing over the current env */
+static int compile_lambda(Compiler *c, Expr *expr) {
+	Expr *param = expr_next(expr_child(expr));
+	Expr *body = expr_next(param);
+	Compiler inner;
+	Scope scope;
+	Code *code = c->code;
+
+	inner.code = code_new();
+	if (inner.code == NULL)
+		return -1;
+	inner.code->nslots = expr_scope(param, body, &inner.code->names, &inner.code->nparams);
+	if (inner.code->nslots < 0)
+		goto error;
+	scope.names = inner.code->names;
+	scope.size = inner.code->nslots;
+	scope.outer = c->scope;
+	inner.scope = &scope;
+	inner.global = c->global;
+	inner.depth = 0;
+	if (compile_expr(&inner, body, 1) < 0)
+		goto error;
+	if (grow((void **)&code->protos, &code->protosmax, code->nprotos, sizeof(Code *)) < 0)
+		goto error;
+	code->protos[code->nprotos] = inner.code;
+	if (emit(c, OP_CLOSURE, 1) < 0)
+		return -1;
+	return emit(c, code->nprotos++, 0);
+error:
+	code_release(inner.code);
+	return -1;
+}
+
+static int compile_if(Compiler *c, Expr *expr, int tail) {
+	Expr *predicate = expr_next(expr_child(expr));
+	Expr *consequent = expr_next(predicate);
+	Expr *alternative = expr_next(consequent);
+	int jumpf, jump, depth;
+	int k;
+
+	if (compile_expr(c, predicate, 0) < 0)
+		return -1;
+	if (emit(c, OP_JUMPF, -1) < 0 || emit(c, 0, 0) < 0)
+		return -1;
+	jumpf = c->code->nops - 1;
+	depth = c->depth;
+	if (compile_expr(c, consequent, tail) < 0)
+		return -1;
+	if (emit(c, OP_JUMP, 0) < 0 || emit(c, 0, 0) < 0)
+		return -1;
+	jump = c->code->nops - 1;
+	/* the false branch starts from the same depth */
+	c->code->ops[jumpf] = c->code->nops;
+	c->depth = depth;
+	if (alternative != NULL) {
+		if (compile_expr(c, alternative, tail) < 0)
+			return -1;
+	} else {
+		if ((k = add_const(c, VALUE_EMPTY)) < 0)
+			return -1;
+		if (emit(c, OP_CONST, 1) < 0 || emit(c, k, 0) < 0)
+			return -1;
+		if (tail && emit(c, OP_RETURN, -1) < 0)
+			return -1;
+	}
+	c->code->ops[jump] = c->code->nops;
+	return 0;
+}
+
+static int compile_cond(Compiler *c, Expr *expr, int tail) {
+	Expr *clause, *predicate;
+	int jumps[expr_len(expr)];
+	int njumps = 0, jumpf = -1, depth = c->depth;
+	int i, k;
+
+	for (clause = expr_next(expr_child(expr)); clause; clause = expr_next(clause)) {
+		if (expr_len(clause) != 2) {
+			fprintf(stderr, "cond: wrong expression format\n");
+			return -1;
+		}
+		predicate = expr_child(clause);
+		c->depth = depth;
+		if (is_else(predicate)) {
+			if (expr_next(clause)) {
+				fprintf(stderr, "cond: misplaced else clause\n");
+				return -1;
+			}
+			if (compile_expr(c, expr_next(predicate), tail) < 0)
+				return -1;
+			break;
+		}
+		if (compile_expr(c, predicate, 0) < 0)
+			return -1;
+		if (emit(c, OP_JUMPF, -1) < 0 || emit(c, 0, 0) < 0)
+			return -1;
+		jumpf = c->code->nops - 1;
+		if (compile_expr(c, expr_next(predicate), tail) < 0)
+			return -1;
+		if (emit(c, OP_JUMP, 0) < 0 || emit(c, 0, 0) < 0)
+			return -1;
+		jumps[njumps++] = c->code->nops - 1;
+		c->code->ops[jumpf] = c->code->nops;
+	}
+	/* no clause matched */
+	if (clause == NULL) {
+		c->depth = depth;
+		if ((k = add_const(c, VALUE_EMPTY)) < 0)
+			return -1;
+		if (emit(c, OP_CONST, 1) < 0 || emit(c, k, 0) < 0)
+			return -1;
+		if (tail && emit(c, OP_RETURN, -1) < 0)
+			return -1;
+	}
+	for (i = 0; i < njumps; i++)
+		c->code->ops[jumps[i]] = c->code->nops;
+	return 0;
+}
+
+/* every form but the last is only run for its effect,
+ * the last one is in tail position if the begin is */
+static int compile_begin(Compiler *c, Expr *expr, int tail) {
+	Expr *e;
+
+	for (e = expr_next(expr_child(expr)); expr_next(e); e = expr_next(e)) {
+		if (compile_expr(c, e, 0) < 0 || emit(c, OP_POP, -1) < 0)
+			return -1;
+	}
+	return compile_expr(c, e, tail);
+}
+
+/* push the procedure, then each operand left to right */
+static int compile_call(Compiler *c, Expr *expr, int tail) {
+	Expr *e;
+	int argc = 0;
+
+	if (expr_child(expr) == NULL)
+		return -1;
+	for (e = expr_child(expr); e; e = expr_next(e)) {
+		if (compile_expr(c, e, 0) < 0)
+			return -1;
+		argc++;
+	}
+	argc--;
+	if (emit(c, (tail) ? OP_TAILCALL : OP_CALL, -argc) < 0)
+		return -1;
+	if (emit(c, argc, 0) < 0)
+		return -1;
+	/* a tail call never falls through */
+	if (tail)
+		c->depth--;
+	return 0;
+}
+
+/* the timed expression is never in tail position,
+ * so OP_TIMED is sure to run after it */
+static int compile_time(Compiler *c, Expr *expr) {
+	if (emit(c, OP_TIME, 0) < 0)
+		return -1;
+	if (compile_expr(c, expr_next(expr_child(expr)), 0) < 0)
+		return -1;
+	return emit(c, OP_TIMED, 0);
+}
+
+/* the same goes for the profiled one */
+static int compile_profile(Compiler *c, Expr *expr) {
+	if (emit(c, OP_PROFILE, 0) < 0)
+		return -1;
+	if (compile_expr(c, expr_next(expr_child(expr)), 0) < 0)
+		return -1;
+	return emit(c, OP_PROFILED, 0);
+}
+
+/* A folded call is its value while the primitives it used are
+ * still what they were, and the call it was after that */
+static int compile_fold(Compiler *c, Expr *expr, int tail) {
+	int first = c->code->nfolds;
+	int jump, k;
+
+	if ((k = add_const(c, expr->fold.value)) < 0 || add_folds(c, expr, first) < 0)
+		return -1;
+	if (emit(c, OP_FOLD, 0) < 0 || emit(c, k, 0) < 0 || emit(c, first, 0) < 0 ||
+			emit(c, c->code->nfolds - first, 0) < 0 || emit(c, 0, 0) < 0)
+		return -1;
+	jump = c->code->nops - 1;
+	if (compile_call(c, expr, 0) < 0)
+		return -1;
+	c->code->ops[jump] = c->code->nops;
+	if (tail)
+		return emit(c, OP_RETURN, -1);
+	return 0;
+}
+
+/* note the operators of expr and of the folded calls among
+ * its operands, leaving out any noted since first */
+static int add_folds(Compiler *c, Expr *expr, int first) {
+	Code *code = c->code;
+	Symbol *sym = expr_get_symbol(expr_child(expr));
+	Fold *fold;
+	Expr *e;
+	int i;
+
+	for (i = first; i < code->nfolds; i++) {
+		if (code->folds[i].symbol == sym && code->folds[i].prim == expr->fold.prim)
+			break;
+	}
+	if (i == code->nfolds) {
+		if (grow((void **)&code->folds, &code->foldsmax, code->nfolds, sizeof(Fold)) < 0)
+			return -1;
+		fold = &code->folds[code->nfolds++];
+		fold->symbol = sym;
+		fold->prim = expr->fold.prim;
+		fold->cache.bind = NULL;
+		fold->cache.version = 0;
+	}
+	for (e = expr_next(expr_child(expr)); e; e = expr_next(e)) {
+		if (expr_form(e) == FORM_FOLDED && add_folds(c, e, first) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* A quoted word or () is a constant. Pairs are only ever
+ * reachable from the collector's roots, so a quoted list
+ * keeps its datum and is built each time it runs */
+static int compile_quote(Compiler *c, Expr *expr) {
+	Expr *datum = expr_next(expr_child(expr));
+	Code *code = c->code;
+	Value v;
+	int k;
+
+	if (is_list(datum)) {
+		if (grow((void **)&code->quotes, &code->quotesmax, code->nquotes, sizeof(Expr *)) < 0)
+			return -1;
+		code->quotes[code->nquotes] = expr_copy(datum);
+		if (code->quotes[code->nquotes] == NULL)
+			return -1;
+		if (emit(c, OP_QUOTE, 1) < 0)
+			return -1;
+		return emit(c, code->nquotes++, 0);
+	}
+	if (quote_value(datum, &v) == RETVAL_ERROR)
+		return -1;
+	if ((k = add_const(c, v)) < 0)
+		return -1;
+	if (emit(c, OP_CONST, 1) < 0 || emit(c, k, 0) < 0)
+		return -1;
+	return 0;
+}
+
+/************************************************/
+/***************   Interpreter   ****************/
+/************************************************/
+
+#ifdef __GNUC__
+/* threaded dispatch, each instruction jumps straight to the next */
+#define DISPATCH() 	goto *labels[*pc++]
+#define CASE(op) 	L_##op
+#else
+#define DISPATCH() 	goto dispatch
+#define CASE(op) 	case op
+#endif
+
+/* show the collector every value on the stack and 
+ * the frame of every running lambda */
+void vm_mark_roots(void) {
+	Value *v;
+	Activation *a;
+
+	for (v = stack; v < vm_sp; v++)
+		gc_mark_value(*v);
+	for (a = calls; a < vm_fp; a++)
+		gc_mark_env(a->env);
+}
+
+/* run code in env until its final return */
+int vm_run(Code *entry_code, Env *env, Value *result) {
+#ifdef __GNUC__
+	static void *labels[OP_MAX] = {
+		[OP_CONST] = &&L_OP_CONST, [OP_LOCAL] = &&L_OP_LOCAL,
+		[OP_GLOBAL] = &&L_OP_GLOBAL, [OP_LOOKUP] = &&L_OP_LOOKUP,
+		[OP_DEFLOCAL] = &&L_OP_DEFLOCAL, [OP_DEFINE] = &&L_OP_DEFINE,
+		[OP_POP] = &&L_OP_POP, [OP_JUMP] = &&L_OP_JUMP,
+		[OP_JUMPF] = &&L_OP_JUMPF, [OP_CLOSURE] = &&L_OP_CLOSURE,
+		[OP_CALL] = &&L_OP_CALL, [OP_TAILCALL] = &&L_OP_TAILCALL,
+		[OP_RETURN] = &&L_OP_RETURN, [OP_LOAD] = &&L_OP_LOAD,
+		[OP_TIME] = &&L_OP_TIME, [OP_TIMED] = &&L_OP_TIMED,
+		[OP_PROFILE] = &&L_OP_PROFILE, [OP_PROFILED] = &&L_OP_PROFILED,
+		[OP_QUOTE] = &&L_OP_QUOTE, [OP_FOLD] = &&L_OP_FOLD,
+	};
+#endif
+	Activation *entry = vm_fp, *a;
+	Value *sp = vm_sp;
+	Code *code = entry_code;
+	int *pc = code->ops;
+	Frame *globals = env_frame(env_global(env)), *f;
+	Lambda *b;
+	Bind *bind;
+	BindCache *cache;
+	Fold *fold;
+	Env *e;
+	Value v;
+	int n, i, retval, tail;
+	int timed = ntimers;
+	int profiled = prof_height(), profiles = prof_level();
+
+	if (vm_fp >= calls + CALLS_MAX || sp + code->maxstack >= stack + STACK_MAX) {
+		fprintf(stderr, "skm: stack overflow\n");
+		return RETVAL_ERROR;
+	}
+	a = vm_fp++;
+	a->code = code;
+	a->env = env;
+	a->base = sp;
+#ifdef __GNUC__
+	DISPATCH();
+#else
+dispatch:
+	switch (*pc++) {
+#endif
+	CASE(OP_CONST):
+		v = code->consts[*pc++];
+		*sp++ = COPY(v);
+		DISPATCH();
+	CASE(OP_LOCAL):
+		e = a->env;
+		for (n = *pc++; n > 0; n--)
+			e = env_parent(e);
+		v = env_frame(e)->slots[*pc++].value;
+		if (v == VALUE_UNBOUND) {
+			fprintf(stderr, "skm: unbound variable %s\n",
+					env_frame(e)->slots[pc[-1]].symbol->name);
+			goto error;
+		}
+		*sp++ = COPY(v);
+		DISPATCH();
+	CASE(OP_GLOBAL):
+		cache = &code->caches[pc[1]];
+		bind = bind_cached(globals, code->syms[*pc], &cache->bind, &cache->version);
+		if (bind == NULL || bind->value == VALUE_UNBOUND)
+			goto unbound;
+		pc += 2;
+		*sp++ = COPY(bind->value);
+		DISPATCH();
+	CASE(OP_LOOKUP):
+		bind = env_search(a->env, code->syms[*pc]);
+		if (bind == NULL || bind->value == VALUE_UNBOUND) {
+		unbound:
+			fprintf(stderr, "skm: unbound variable %s\n", code->syms[*pc]->name);
+			goto error;
+		}
+		pc++;
+		*sp++ = COPY(bind->value);
+		DISPATCH();
+	CASE(OP_DEFLOCAL):
+		lambda_name(sp[-1], env_frame(a->env)->slots[*pc].symbol);
+		bind_set(&env_frame(a->env)->slots[*pc++], sp[-1]);
+		DISPATCH();
+	CASE(OP_DEFINE):
+		lambda_name(sp[-1], code->syms[*pc]);
+		bind = bind_new(code->syms[*pc++], sp[-1]);
+		if (bind == NULL)
+			goto error;
+		if (bind_add(a->env, bind) == NULL) {
+			bind_free(bind);
+			goto error;
+		}
+		DISPATCH();
+	CASE(OP_POP):
+		v = *--sp;
+		DROP(v);
+		DISPATCH();
+	CASE(OP_JUMP):
+		pc = code->ops + *pc;
+		DISPATCH();
+	CASE(OP_JUMPF):
+		v = *--sp;
+		if (v == VALUE_FALSE)
+			pc = code->ops + *pc;
+		else
+			pc++;
+		DROP(v);
+		DISPATCH();
+	CASE(OP_CLOSURE):
+		/* let the collector see the stack */
+		vm_sp = sp;
+		b = lambda_new(a->env, NULL);
+		if (b == NULL)
+			goto error;
+		b->code = code->protos[*pc++];
+		b->code->refs++;
+		b->nparams = b->code->nparams;
+		*sp++ = value_ptr(TAG_LAMBDA, b);
+		DISPATCH();
+	CASE(OP_CALL):
+		tail = 0;
+		goto call;
+	CASE(OP_TAILCALL):
+		tail = 1;
+	call:
+		vm_sp = sp;
+		n = *pc++;
+		v = sp[-n - 1];
+		if (value_tag(v) != TAG_LAMBDA) {
+			fprintf(stderr, "skm: not a procedure\n");
+			goto error;
+		}
+		b = value_get_lambda(v);
+		if (b->code == NULL) {
+			if (!is_prim(b)) {
+				fprintf(stderr, "skm: can't apply a procedure made without -b\n");
+				goto error;
+			}
+			if (prof_on)
+				prof_enter(b);
+			retval = apply_primitive(b, n, sp - n, &v);
+			if (prof_on)
+				prof_exit();
+			if (retval == RETVAL_ERROR)
+				goto error;
+			/* drop the operands and the procedure */
+			for (i = 0; i <= n; i++) {
+				sp--;
+				DROP(*sp);
+			}
+			*sp++ = v;
+			if (tail)
+				goto L_return;
+			DISPATCH();
+		}
+		if (b->code->nparams != n) {
+			fprintf(stderr, "skm: wrong number of arguments\n");
+			goto error;
+		}
+		/* parameters take the first slots of a new frame */
+		f = frame_new(b->code->names, b->code->nslots);
+		if (f == NULL)
+			goto error;
+		e = env_extend(b->env, f);
+		if (e == NULL) {
+			frame_free(f);
+			goto error;
+		}
+		for (i = 0; i < n; i++) {
+			/* the frame takes the value over */
+			f->slots[i].value = sp[i - n];
+		}
+		sp -= n;
+		b->code->refs++;
+		if (tail) {
+			/* the procedure is all that's left above the base */
+			v = *--sp;
+			while (sp > a->base) {
+				sp--;
+				DROP(*sp);
+			}
+			a->base[-1] = v;
+			code_release(a->code);
+			/* the frame we leave is done with */
+			env_release(a->env);
+		} else {
+			if (vm_fp >= calls + CALLS_MAX || sp + b->code->maxstack >= stack + STACK_MAX) {
+				fprintf(stderr, "skm: stack overflow\n");
+				code_release(b->code);
+				goto error;
+			}
+			a->pc = pc;
+			a = vm_fp++;
+			a->base = sp;
+		}
+		a->code = code = b->code;
+		a->env = e;
+		pc = code->ops;
+		if (prof_on) {
+			if (tail)
+				prof_tail(b);
+			else
+				prof_enter(b);
+		}
+		DISPATCH();
+	CASE(OP_RETURN):
+	L_return:
+		v = *--sp;
+		if (a == entry) {
+			vm_fp = entry;
+			vm_sp = sp;
+			*result = v;
+			return value_type(v);
+		}
+		if (prof_on)
+			prof_exit();
+		/* pop the procedure and resume the caller */
+		sp = a->base - 1;
+		code_release(a->code);
+		env_release(a->env);
+		a = --vm_fp - 1;
+		code = a->code;
+		pc = a->pc;
+		*sp++ = v;
+		DISPATCH();
+	CASE(OP_LOAD):
+		v = *--sp;
+		if (value_tag(v) != TAG_STRING) {
+			DROP(v);
+			goto error;
+		}
+		/* the file runs above us on the same stack */
+		vm_sp = sp;
+		a->pc = pc;
+		retval = load(a->env, value_get_string(v), vm_eval, load_report, &v);
+		if (retval == RETVAL_ERROR)
+			goto error;
+		*sp++ = v;
+		DISPATCH();
+	CASE(OP_TIME):
+		if (ntimers == TIMERS_MAX) {
+			fprintf(stderr, "skm: time nested too deep\n");
+			goto error;
+		}
+		usage_get(&timers[ntimers++]);
+		DISPATCH();
+	CASE(OP_TIMED):
+		usage_report(&timers[--ntimers]);
+		DISPATCH();
+	CASE(OP_PROFILE):
+		prof_begin();
+		DISPATCH();
+	CASE(OP_PROFILED):
+		prof_end();
+		DISPATCH();
+	CASE(OP_FOLD):
+		for (i = pc[1]; i < pc[1] + pc[2]; i++) {
+			fold = &code->folds[i];
+			bind = bind_cached(globals, fold->symbol, &fold->cache.bind, &fold->cache.version);
+			if (bind == NULL || !calls_prim(bind->value, fold->prim)) {
+				pc += 4;
+				DISPATCH();
+			}
+		}
+		*sp++ = code->consts[*pc];
+		pc = code->ops + pc[3];
+		DISPATCH();
+	CASE(OP_QUOTE):
+		/* let the collector see the stack */
+		vm_sp = sp;
+		if (quote_value(code->quotes[*pc++], &v) == RETVAL_ERROR)
+			goto error;
+		*sp++ = v;
+		DISPATCH();
+#ifndef __GNUC__
+	default:
+		goto error;
+	}
+#endif
+error:
+	/* unwind everything this run pushed */
+	while (vm_fp - 1 > entry) {
+		a = --vm_fp;
+		while (sp > a->base) {
+			sp--;
+			DROP(*sp);
+		}
+		/* and the procedure */
+		sp--;
+		code_release(a->code);
+		env_release(a->env);
+	}
+	while (sp > entry->base) {
+		sp--;
+		DROP(*sp);
+	}
+	vm_fp = entry;
+	vm_sp = sp;
+	/* and the (time) and (profile) forms it left running */
+	ntimers = timed;
+	if (prof_on)
+		prof_unwind(profiled);
+	while (prof_level() > profiles)
+		prof_end();
+	return RETVAL_ERROR;
+}
@@ -0,0 +1,85 @@
+/* skm - scheme interpreter
+ * author: Eugene Ma (edma2) */
+#ifndef VM_H
+#define VM_H
+#include "skm.h"
+
+/* instructions, operands follow inline in the code */
+enum {
+	OP_CONST, 	/* k: push constant k */
+	OP_LOCAL, 	/* depth slot: push a frame slot */
+	OP_GLOBAL, 	/* k c: push symbol k from the global frame, cache c
+			 * remembers its binding */
+	OP_LOOKUP, 	/* k: push symbol k, searching by name */
+	OP_DEFLOCAL, 	/* slot: bind top of stack in this frame */
+	OP_DEFINE, 	/* k: bind top of stack to symbol k */
+	OP_POP, 	/* discard top of stack */
+	OP_JUMP, 	/* target */
+	OP_JUMPF, 	/* target: pop, jump if it was #f */
+	OP_CLOSURE, 	/* k: push a lambda of code k */
+	OP_CALL, 	/* argc: apply the procedure below the operands */
+	OP_TAILCALL, 	/* argc: same, reusing this activation */
+	OP_RETURN, 	/* pop result and return it */
+	OP_LOAD, 	/* pop filename, evaluate the file */
+	OP_TIME, 	/* start timing */
+	OP_TIMED, 	/* report what it's cost since the matching OP_TIME */
+	OP_PROFILE, 	/* start a profile */
+	OP_PROFILED, 	/* report it */
+	OP_QUOTE, 	/* k: push the value of quoted list k */
+	OP_FOLD, 	/* k first n target: push constant k and jump if
+			 * folds first to first + n still run their
+			 * primitives */
+	OP_MAX
+};
+
+/* the operator of a folded call, which is folded while the
+ * global binding of symbol still runs prim */
+typedef struct {
+	Symbol *symbol;
+	Primitive *prim;
+	BindCache cache;
+} Fold;
+
+/* a compiled lambda body or top level form */
+struct Code {
+	int *ops;
+	int nops;
+	int opsmax;
+	/* constant pool */
+	Value *consts;
+	int nconsts;
+	int constsmax;
+	Symbol **syms;
+	int nsyms;
+	int symsmax;
+	/* one for every global reference */
+	BindCache *caches;
+	int ncaches;
+	int cachesmax;
+	/* what the folded calls were worked out with */
+	Fold *folds;
+	int nfolds;
+	int foldsmax;
+	/* quoted lists, copied out of the form */
+	Expr **quotes;
+	int nquotes;
+	int quotesmax;
+	/* code of nested lambdas */
+	Code **protos;
+	int nprotos;
+	int protosmax;
+	/* frame layout of the lambda */
+	Symbol **names;
+	int nparams;
+	int nslots;
+	/* deepest the operand stack gets */
+	int maxstack;
+	int refs;
+};
+
+Code *compile(Env *env, Expr *expr);
+int vm_eval(Env *env, Expr *expr, Value *result);
+int vm_run(Code *code, Env *env, Value *result);
+void code_release(Code *code);
+void vm_mark_roots(void);
+#endif